@@ -26,6 +26,133 @@ void main() {\
 	gl_FragColor = sum / float(samples);\
 }";
 
+// maskBlurShader for the destination and up to three sources at once, so
+// the mask taps are shared. tex0 goes to gl_FragData[0] and so on.
+char multiMaskBlurShaderSource[] =
+"#extension GL_ARB_texture_rectangle : enable\n"
+"uniform sampler2DRect tex0, tex1, tex2, tex3, mask;\
+uniform vec2 direction;\
+uniform int k, count;\
+void main() {\
+	vec2 pos = gl_TexCoord[0].st;\
+	vec4 sum0 = texture2DRect(tex0, pos);\
+	vec4 sum1 = count > 1 ? texture2DRect(tex1, pos) : vec4(0.);\
+	vec4 sum2 = count > 2 ? texture2DRect(tex2, pos) : vec4(0.);\
+	vec4 sum3 = count > 3 ? texture2DRect(tex3, pos) : vec4(0.);\
+	int i;\
+	for(i = 1; i < k; i++) {\
+		vec2 curOffset = float(i) * direction;\
+		vec4 leftMask = texture2DRect(mask, pos - curOffset);\
+		vec4 rightMask = texture2DRect(mask, pos + curOffset);\
+		bool valid = leftMask.r == 1. && rightMask.r == 1.;\
+		if(valid) {\
+			sum0 += texture2DRect(tex0, pos + curOffset) + texture2DRect(tex0, pos - curOffset);\
+			if(count > 1) sum1 += texture2DRect(tex1, pos + curOffset) + texture2DRect(tex1, pos - curOffset);\
+			if(count > 2) sum2 += texture2DRect(tex2, pos + curOffset) + texture2DRect(tex2, pos - curOffset);\
+			if(count > 3) sum3 += texture2DRect(tex3, pos + curOffset) + texture2DRect(tex3, pos - curOffset);\
+		} else {\
+			break;\
+		}\
+	}\
+	float samples = float(1 + (i - 1) * 2);\
+	gl_FragData[0] = sum0 / samples;\
+	if(count > 1) gl_FragData[1] = sum1 / samples;\
+	if(count > 2) gl_FragData[2] = sum2 / samples;\
+	if(count > 3) gl_FragData[3] = sum3 / samples;\
+}";
+
+// number of consecutive mask pixels before (rg) and after (ba) each pixel,
+// horizontally in xy and vertically in zw. this starts capped at 1.
+char maskRunsShaderSource[] =
+"#extension GL_ARB_texture_rectangle : enable\n"
+"uniform sampler2DRect mask;\
+float inside(vec2 pos) {\
+	return texture2DRect(mask, pos).r == 1. ? 1. : 0.;\
+}\
+void main() {\
+	vec2 pos = gl_TexCoord[0].st;\
+	gl_FragColor = vec4(\
+		inside(pos - vec2(1., 0.)),\
+		inside(pos + vec2(1., 0.)),\
+		inside(pos - vec2(0., 1.)),\
+		inside(pos + vec2(0., 1.)));\
+}";
+
+// doubles the cap on the runs: a run that reaches n continues with the run
+// of the pixel n steps further along
+char maskRunsDoubleShaderSource[] =
+"#extension GL_ARB_texture_rectangle : enable\n"
+"uniform sampler2DRect runs;\
+uniform float n;\
+void main() {\
+	vec2 pos = gl_TexCoord[0].st;\
+	vec4 cur = texture2DRect(runs, pos);\
+	float left = texture2DRect(runs, pos - vec2(n, 0.)).x;\
+	float right = texture2DRect(runs, pos + vec2(n, 0.)).y;\
+	float up = texture2DRect(runs, pos - vec2(0., n)).z;\
+	float down = texture2DRect(runs, pos + vec2(0., n)).w;\
+	gl_FragColor = vec4(\
+		cur.x == n ? n + left : cur.x,\
+		cur.y == n ? n + right : cur.y,\
+		cur.z == n ? n + up : cur.z,\
+		cur.w == n ? n + down : cur.w);\
+}";
+
+// one radix 4 hillis-steele step of an inclusive prefix sum along
+// direction, starting at start. each pixel adds the sums n, 2n and 3n
+// pixels back, so a span takes log4 of its length passes instead of log2.
+char prefixSumShaderSource[] =
+"#extension GL_ARB_texture_rectangle : enable\n"
+"uniform sampler2DRect sums;\
+uniform vec2 direction;\
+uniform float n, start;\
+void main() {\
+	vec2 pos = gl_TexCoord[0].st;\
+	vec4 sum = texture2DRect(sums, pos);\
+	for(int i = 1; i < 4; i++) {\
+		vec2 prev = pos - float(i) * n * direction;\
+		if(dot(prev, direction) > start) {\
+			sum += texture2DRect(sums, prev);\
+		}\
+	}\
+	gl_FragColor = sum;\
+}";
+
+// the same average as maskBlurShader, from two prefix sum lookups. outside
+// the summed span the sum continues with the edge pixel, like the clamped
+// taps at the edge of the texture.
+char boxBlurShaderSource[] =
+"#extension GL_ARB_texture_rectangle : enable\n"
+"uniform sampler2DRect tex, sums, runs;\
+uniform vec2 direction;\
+uniform vec4 before, after;\
+uniform float start, size;\
+uniform int k;\
+vec2 pos;\
+float x;\
+vec2 at(float i) {\
+	return pos + (i - x) * direction;\
+}\
+vec4 prefix(float i) {\
+	float end = start + size - 1.;\
+	if(i < start) {\
+		return (i - start + 1.) * texture2DRect(tex, at(start));\
+	}\
+	if(i > end) {\
+		return texture2DRect(sums, at(end)) +\
+			(i - end) * texture2DRect(tex, at(end));\
+	}\
+	return texture2DRect(sums, at(i));\
+}\
+void main() {\
+	pos = gl_TexCoord[0].st;\
+	x = floor(dot(pos, direction));\
+	vec4 run = texture2DRect(runs, pos);\
+	float r = min(float(k - 1), min(dot(run, before), dot(run, after)));\
+	r = max(r, 0.);\
+	gl_FragColor = (prefix(x + r) - prefix(x - r - 1.)) / (2. * r + 1.);\
+}";
+
 char cloneShaderSource[] = 
 "#extension GL_ARB_texture_rectangle : enable\n"
 "uniform sampler2DRect src, srcBlur, dstBlur;\
@@ -50,13 +177,37 @@ void Clone::setup(int width, int height) {
 	buffer.allocate(settings);
 	srcBlur.allocate(settings);
 	dstBlur.allocate(settings);
+	outputs.resize(1);
+	outputs[0].allocate(settings);
+	
+	settings.numColorbuffers = 1 + maxSources;
+	multiBuffer.allocate(settings);
+	multiBlur.allocate(settings);
 	
 	maskBlurShader.setupShaderFromSource(GL_FRAGMENT_SHADER, maskBlurShaderSource);
 	cloneShader.setupShaderFromSource(GL_FRAGMENT_SHADER, cloneShaderSource);
 	maskBlurShader.linkProgram();
 	cloneShader.linkProgram();
 	
+	multiMaskBlurShader.setupShaderFromSource(GL_FRAGMENT_SHADER, multiMaskBlurShaderSource);
+	multiMaskBlurShader.linkProgram();
+	
+	maskRunsShader.setupShaderFromSource(GL_FRAGMENT_SHADER, maskRunsShaderSource);
+	maskRunsDoubleShader.setupShaderFromSource(GL_FRAGMENT_SHADER, maskRunsDoubleShaderSource);
+	prefixSumShader.setupShaderFromSource(GL_FRAGMENT_SHADER, prefixSumShaderSource);
+	boxBlurShader.setupShaderFromSource(GL_FRAGMENT_SHADER, boxBlurShaderSource);
+	maskRunsShader.linkProgram();
+	maskRunsDoubleShader.linkProgram();
+	prefixSumShader.linkProgram();
+	boxBlurShader.linkProgram();
+	
 	strength = 0;
+	roi.set(0, 0, width, height);
+	dstTexture = NULL;
+	maskTexture = NULL;
+	usePrefixSumBlur = false;
+	maskRunsIndex = 0;
+	sumsIndex = 0;
 }
 
 void Clone::maskedBlur(ofTexture& tex, ofTexture& mask, ofFbo& result) {
@@ -68,7 +219,7 @@ void Clone::maskedBlur(ofTexture& tex, ofTexture& mask, ofFbo& result) {
 	maskBlurShader.setUniformTexture("mask", mask, 2);
 	maskBlurShader.setUniform2f("direction", 1, 0);
 	maskBlurShader.setUniform1i("k", k);
-	tex.draw(0, 0);
+	drawRoi(tex);
 	maskBlurShader.end();
 	buffer.end();
 	
@@ -78,34 +229,263 @@ void Clone::maskedBlur(ofTexture& tex, ofTexture& mask, ofFbo& result) {
 	maskBlurShader.setUniformTexture("mask", mask, 2);
 	maskBlurShader.setUniform2f("direction", 0, 1);
 	maskBlurShader.setUniform1i("k", k);
-	buffer.draw(0, 0);
+	drawRoi(buffer.getTextureReference());
 	maskBlurShader.end();
 	result.end();
 }
 
+void Clone::multiMaskedBlur(vector<ofTexture*>& texs, ofTexture& mask) {
+	int n = texs.size();
+	
+	multiBuffer.begin();
+	multiBuffer.activateAllDrawBuffers();
+	multiMaskBlurShader.begin();
+	for(int i = 0; i < n; i++) {
+		multiMaskBlurShader.setUniformTexture("tex" + ofToString(i), *texs[i], 1 + i);
+	}
+	multiMaskBlurShader.setUniformTexture("mask", mask, 1 + n);
+	multiMaskBlurShader.setUniform2f("direction", 1, 0);
+	multiMaskBlurShader.setUniform1i("k", strength);
+	multiMaskBlurShader.setUniform1i("count", n);
+	drawRoi(*texs[0]);
+	multiMaskBlurShader.end();
+	multiBuffer.end();
+	
+	multiBlur.begin();
+	multiBlur.activateAllDrawBuffers();
+	multiMaskBlurShader.begin();
+	for(int i = 0; i < n; i++) {
+		multiMaskBlurShader.setUniformTexture("tex" + ofToString(i), multiBuffer.getTextureReference(i), 1 + i);
+	}
+	multiMaskBlurShader.setUniformTexture("mask", mask, 1 + n);
+	multiMaskBlurShader.setUniform2f("direction", 0, 1);
+	multiMaskBlurShader.setUniform1i("k", strength);
+	multiMaskBlurShader.setUniform1i("count", n);
+	drawRoi(multiBuffer.getTextureReference(0));
+	multiMaskBlurShader.end();
+	multiBlur.end();
+}
+
+void Clone::updateMaskRuns(ofTexture& mask) {
+	if(!maskRuns[0].isAllocated()) {
+		ofFbo::Settings settings;
+		settings.width = buffer.getWidth();
+		settings.height = buffer.getHeight();
+		settings.internalformat = GL_RGBA32F;
+		maskRuns[0].allocate(settings);
+		maskRuns[1].allocate(settings);
+		sums[0].allocate(settings);
+		sums[1].allocate(settings);
+	}
+	
+	ofPushStyle();
+	ofDisableAlphaBlending();
+	maskRunsIndex = 0;
+	maskRuns[maskRunsIndex].begin();
+	maskRunsShader.begin();
+	maskRunsShader.setUniformTexture("mask", mask, 1);
+	drawRoi(mask);
+	maskRunsShader.end();
+	maskRuns[maskRunsIndex].end();
+	
+	// only as many doublings as the blur radius needs
+	for(int n = 1; n < strength - 1; n *= 2) {
+		ofFbo& cur = maskRuns[maskRunsIndex];
+		ofFbo& next = maskRuns[1 - maskRunsIndex];
+		next.begin();
+		maskRunsDoubleShader.begin();
+		maskRunsDoubleShader.setUniformTexture("runs", cur, 1);
+		maskRunsDoubleShader.setUniform1f("n", n);
+		drawRoi(cur.getTextureReference());
+		maskRunsDoubleShader.end();
+		next.end();
+		maskRunsIndex = 1 - maskRunsIndex;
+	}
+	ofPopStyle();
+}
+
+void Clone::prefixSum(ofTexture& tex, ofVec2f direction, int start, int length) {
+	ofTexture* cur = &tex;
+	for(int n = 1; n < length; n *= 4) {
+		ofFbo& next = sums[1 - sumsIndex];
+		next.begin();
+		prefixSumShader.begin();
+		prefixSumShader.setUniformTexture("sums", *cur, 1);
+		prefixSumShader.setUniform2f("direction", direction.x, direction.y);
+		prefixSumShader.setUniform1f("n", n);
+		prefixSumShader.setUniform1f("start", start);
+		drawRoi(*cur);
+		prefixSumShader.end();
+		next.end();
+		sumsIndex = 1 - sumsIndex;
+		cur = &next.getTextureReference();
+	}
+}
+
+void Clone::boxBlur(ofTexture& tex, ofVec2f direction, int start, int length, ofFbo& result) {
+	bool horizontal = direction.x > 0;
+	result.begin();
+	boxBlurShader.begin();
+	boxBlurShader.setUniformTexture("tex", tex, 1);
+	boxBlurShader.setUniformTexture("sums", sums[sumsIndex], 2);
+	boxBlurShader.setUniformTexture("runs", maskRuns[maskRunsIndex], 3);
+	boxBlurShader.setUniform2f("direction", direction.x, direction.y);
+	boxBlurShader.setUniform4f("before", horizontal, 0, !horizontal, 0);
+	boxBlurShader.setUniform4f("after", 0, horizontal, 0, !horizontal);
+	boxBlurShader.setUniform1f("start", start);
+	boxBlurShader.setUniform1f("size", length);
+	boxBlurShader.setUniform1i("k", strength);
+	drawRoi(tex);
+	boxBlurShader.end();
+	result.end();
+}
+
+// same output as maskedBlur, including the 8 bit intermediate in buffer.
+// expects updateMaskRuns() to have been called for the current mask.
+void Clone::prefixSumBlur(ofTexture& tex, ofFbo& result) {
+	ofPushStyle();
+	ofDisableAlphaBlending();
+	ofVec2f horizontal(1, 0), vertical(0, 1);
+	prefixSum(tex, horizontal, roi.x, roi.width);
+	boxBlur(tex, horizontal, roi.x, roi.width, buffer);
+	prefixSum(buffer.getTextureReference(), vertical, roi.y, roi.height);
+	boxBlur(buffer.getTextureReference(), vertical, roi.y, roi.height, result);
+	ofPopStyle();
+}
+
+// only the roi of each pass is drawn. the blurs only reach as far as the
+// mask, so everything they read is inside the roi as long as it covers the
+// mask, and outside of it the clone output is just dst.
+void Clone::drawRoi(ofTexture& tex) {
+	tex.drawSubsection(roi.x, roi.y, roi.width, roi.height, roi.x, roi.y);
+}
+
 void Clone::setStrength(int strength) {
 	this->strength = strength;
 }
 
+void Clone::setPrefixSumBlur(bool prefixSumBlur) {
+	usePrefixSumBlur = prefixSumBlur;
+}
+
+// runs both blur modes on tex and returns the largest difference of any
+// channel, in 8 bit steps. the results go to scratch fbos and the roi and
+// mask runs of the last update() are restored, so the live output doesn't
+// change.
+float Clone::compareBlurModes(ofTexture& tex, ofTexture& mask) {
+	ofFbo reference, candidate;
+	reference.allocate(buffer.getWidth(), buffer.getHeight());
+	candidate.allocate(buffer.getWidth(), buffer.getHeight());
+	ofRectangle lastRoi = roi;
+	roi.set(0, 0, buffer.getWidth(), buffer.getHeight());
+	maskedBlur(tex, mask, reference);
+	updateMaskRuns(mask);
+	prefixSumBlur(tex, candidate);
+	roi = lastRoi;
+	if(usePrefixSumBlur && maskTexture != NULL) {
+		updateMaskRuns(*maskTexture);
+	}
+	
+	ofPixels referencePixels, candidatePixels;
+	reference.readToPixels(referencePixels);
+	candidate.readToPixels(candidatePixels);
+	int difference = 0;
+	int n = referencePixels.size();
+	for(int i = 0; i < n; i++) {
+		difference = MAX(difference, abs(referencePixels[i] - candidatePixels[i]));
+	}
+	return difference;
+}
+
 void Clone::update(ofTexture& src, ofTexture& dst, ofTexture& mask) {
-	maskedBlur(src, mask, srcBlur);
-	maskedBlur(dst, mask, dstBlur);
+	update(src, dst, mask, ofRectangle(0, 0, buffer.getWidth(), buffer.getHeight()));
+}
+
+void Clone::update(ofTexture& src, ofTexture& dst, ofTexture& mask, const ofRectangle& roi) {
+	setDestination(dst, mask, roi);
+	updateSource(src, 0);
+}
+
+// blurs the destination, and the mask edge distances in prefix sum mode,
+// once for any number of updateSource() calls against the same dst and mask
+void Clone::setDestination(ofTexture& dst, ofTexture& mask, const ofRectangle& roi) {
+	setRoi(roi);
+	dstTexture = &dst;
+	maskTexture = &mask;
 	
-	buffer.begin();
+	if(usePrefixSumBlur) {
+		updateMaskRuns(mask);
+		prefixSumBlur(dst, dstBlur);
+	} else {
+		maskedBlur(dst, mask, dstBlur);
+	}
+}
+
+// clones src onto the last setDestination() into output i
+void Clone::updateSource(ofTexture& src, int i) {
+	if(usePrefixSumBlur) {
+		prefixSumBlur(src, srcBlur);
+	} else {
+		maskedBlur(src, *maskTexture, srcBlur);
+	}
+	clonePass(src, srcBlur.getTextureReference(), dstBlur.getTextureReference(), i);
+}
+
+// the destination and all the sources are blurred by the same two
+// multiple render target passes, source i ends up in output i. the prefix
+// sum blur doesn't have a multiple target version and blurs them one by one.
+void Clone::update(vector<ofTexture*>& srcs, ofTexture& dst, ofTexture& mask, const ofRectangle& roi) {
+	if(usePrefixSumBlur || srcs.size() > maxSources) {
+		setDestination(dst, mask, roi);
+		for(int i = 0; i < srcs.size(); i++) {
+			updateSource(*srcs[i], i);
+		}
+		return;
+	}
+	
+	setRoi(roi);
+	dstTexture = &dst;
+	maskTexture = &mask;
+	vector<ofTexture*> texs(1, &dst);
+	texs.insert(texs.end(), srcs.begin(), srcs.end());
+	multiMaskedBlur(texs, mask);
+	for(int i = 0; i < srcs.size(); i++) {
+		clonePass(*srcs[i], multiBlur.getTextureReference(1 + i), multiBlur.getTextureReference(0), i);
+	}
+}
+
+void Clone::setRoi(const ofRectangle& roi) {
+	// whole pixels, inside the frame
+	int left = MAX(floor(roi.getLeft()), 0), top = MAX(floor(roi.getTop()), 0);
+	int right = MIN(ceil(roi.getRight()), buffer.getWidth()), bottom = MIN(ceil(roi.getBottom()), buffer.getHeight());
+	this->roi.set(left, top, MAX(right - left, 0), MAX(bottom - top, 0));
+}
+
+void Clone::clonePass(ofTexture& src, ofTexture& srcBlurTexture, ofTexture& dstBlurTexture, int i) {
+	int n = outputs.size();
+	if(n <= i) {
+		outputs.resize(i + 1);
+		for(int j = n; j <= i; j++) {
+			outputs[j].allocate(buffer.getWidth(), buffer.getHeight());
+		}
+	}
+	
+	ofFbo& output = outputs[i];
+	output.begin();
 	ofPushStyle();
 	ofEnableAlphaBlending();
-	dst.draw(0, 0);	
+	dstTexture->draw(0, 0);
 	cloneShader.begin();
 	cloneShader.setUniformTexture("src", src, 1);
-	cloneShader.setUniformTexture("srcBlur", srcBlur, 2);
-	cloneShader.setUniformTexture("dstBlur", dstBlur, 3);
-	dst.draw(0, 0);
+	cloneShader.setUniformTexture("srcBlur", srcBlurTexture, 2);
+	cloneShader.setUniformTexture("dstBlur", dstBlurTexture, 3);
+	drawRoi(*dstTexture);
 	cloneShader.end();
 	ofDisableAlphaBlending();
 	ofPopStyle();
-	buffer.end();
+	output.end();
 }
 
 void Clone::draw(float x, float y) {
-	buffer.draw(x, y);
+	outputs[0].draw(x, y);
 }
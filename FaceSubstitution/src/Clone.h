@@ -6,15 +6,53 @@ class Clone {
 public:
 	void setup(int width, int height);
 	void setStrength(int strength);
+	int getStrength() const {
+		return strength;
+	}
+	void setPrefixSumBlur(bool prefixSumBlur);
+	float compareBlurModes(ofTexture& tex, ofTexture& mask);
 	void update(ofTexture& src, ofTexture& dst, ofTexture& mask);
+	void update(ofTexture& src, ofTexture& dst, ofTexture& mask, const ofRectangle& roi);
+	void setDestination(ofTexture& dst, ofTexture& mask, const ofRectangle& roi);
+	void updateSource(ofTexture& src, int i);
+	void update(vector<ofTexture*>& srcs, ofTexture& dst, ofTexture& mask, const ofRectangle& roi);
+	
+	// the most sources update(srcs, ...) blurs in one set of passes
+	static const int maxSources = 3;
+	
 	void draw(float x, float y);
-    ofTexture& getTexture() {
-        return buffer.getTextureReference();
+    ofTexture& getTexture(int i = 0) {
+        return outputs[i].getTextureReference();
+    }
+    ofFbo& getFbo(int i = 0) {
+        return outputs[i];
     }
 	
 protected:
 	void maskedBlur(ofTexture& tex, ofTexture& mask, ofFbo& result);
+	void multiMaskedBlur(vector<ofTexture*>& texs, ofTexture& mask);
+	void setRoi(const ofRectangle& roi);
+	void drawRoi(ofTexture& tex);
+	void clonePass(ofTexture& src, ofTexture& srcBlurTexture, ofTexture& dstBlurTexture, int i);
+	void updateMaskRuns(ofTexture& mask);
+	void prefixSum(ofTexture& tex, ofVec2f direction, int start, int length);
+	void boxBlur(ofTexture& tex, ofVec2f direction, int start, int length, ofFbo& result);
+	void prefixSumBlur(ofTexture& tex, ofFbo& result);
 	ofFbo buffer, srcBlur, dstBlur;
+	ofFbo multiBuffer, multiBlur;
+	ofShader multiMaskBlurShader;
+	vector<ofFbo> outputs;
+	ofTexture* dstTexture;
+	ofTexture* maskTexture;
 	ofShader maskBlurShader, cloneShader;
 	int strength;
+	ofRectangle roi;
+	
+	// prefix sum mode: the distance to the mask edge in each direction is
+	// computed once per update, then each blur pass is a prefix sum along
+	// the pass direction and a box average that costs the same at any radius
+	bool usePrefixSumBlur;
+	ofFbo maskRuns[2], sums[2];
+	int maskRunsIndex, sumsIndex;
+	ofShader maskRunsShader, maskRunsDoubleShader, prefixSumShader, boxBlurShader;
 };
\ No newline at end of file
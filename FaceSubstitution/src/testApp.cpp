@@ -13,12 +13,20 @@ void testApp::setupGui() {
     gui->addToggle("Debug", &(debug=false));
     gui->addSlider("Max offset", 0, 600, &(maxOffset=250));
     gui->addSlider("Tracker rescale", .1, 1, &(trackerRescale=.5));
+    gui->addSlider("Tracker fit interval", 1, 10, &(trackerFitInterval=1));
+    gui->addToggle("Tracker roi", &(trackerRoi=false));
     gui->addSlider("Substitution strength", 0, 64, &(substitutionStrength=20));
     gui->addSlider("Motion max", 0, 100, &(motionMax=24));
     gui->addSlider("Motion strength", -100, 100, &motionAmplifier.strength);
     gui->addSlider("Motion learning rate", 0, 1, &motionAmplifier.learningRate);
     gui->addSlider("Motion blur amount", 0, 15, &motionAmplifier.blurAmount);
     gui->addSlider("Motion window size", 1, 64, &motionAmplifier.windowSize);
+    gui->addToggle("Motion async", &(motionAsync=false));
+    gui->addToggle("Motion gpu accumulation", &(motionGpuAccumulation=false));
+    gui->addToggle("Motion sparse", &(motionSparse=false));
+    gui->addToggle("Prefix sum blur", &(prefixSumBlur=false));
+    gui->addToggle("Multi face", &(multiFace=false));
+    gui->addToggle("Face atlas", &(faceAtlasMode=false));
     gui->autoSizeToFitWidgets();
     keyPressed('\t');
 }
@@ -43,20 +51,45 @@ void testApp::setup() {
     #endif
 #endif
     camTimer.setSmoothing(.99);
+    camHistory.setup(cam.getWidth(), cam.getHeight());
     
 	camTracker.setup();
     camTracker.setRescale(trackerRescale);
     camTracker.setHaarMinSize(cam.getHeight() / 4);
+    multiTracker.setup();
+    faceFound = false;
+    droppedFace = false;
     
     faceSubstitution.setup(cam.getWidth(), cam.getHeight());
     substitutionTimer.setLength(10, 0);
     
 	faceMeshes.allowExt("ply");
 	faceMeshes.listDir("meshes");
+    // in the same order as the face library, so an index is the same face
+    // with and without it
+    faceMeshes.sort();
+    // built by ProcessCrowdFaces, the meshes and faces folders are only
+    // used when it's missing
+    if(faceLibrary.load("faces.bin")) {
+        ofLog() << "Using face library with " << faceLibrary.size() << " faces.";
+        faceAtlas.setup(faceLibrary);
+    } else {
+        faceLoader.setup(faceMeshes);
+    }
 	currentFace = 0;
+    originalFace = 0;
+    delayFace = 0;
     loadNextPair();
 
+#ifdef USE_GPU_SLITSCAN
+    // 5 seconds at 30 fps, enough for delaySeconds. yuv420 is 1.5 bytes a
+    // pixel, so at 1280x720 the 150 frames take 207MB of vram, three quarters
+    // of the 276MB the 100 rgb frames of ofxSlitScan took
+    slitScan.setup(cam.getWidth(), cam.getHeight(), 150, GpuSlitScan::YUV420);
+#else
     slitScan.setup(cam.getWidth(), cam.getHeight(), 100);
+    delayReadback.setup(cam.getWidth(), cam.getHeight());
+#endif
     slitScan.setBlending(false);
     slitScan.setTimeDelayAndWidth(0, 0);
     delaySeconds = 3;
@@ -68,14 +101,21 @@ void testApp::setup() {
     lighten.load("shaders/Lighten");
     
     motionAmplifier.setup(cam.getWidth(), cam.getHeight(), 1, .25);
-    amplifiedMotionOriginal.allocate(cam.getWidth(), cam.getHeight());
-    amplifiedMotionDelay.allocate(cam.getWidth(), cam.getHeight());
+    // color buffer 0 is the original, 1 is the delay
+    ofFbo::Settings amplifiedSettings;
+    amplifiedSettings.width = cam.getWidth();
+    amplifiedSettings.height = cam.getHeight();
+    amplifiedSettings.numColorbuffers = 2;
+    amplifiedMotion.allocate(amplifiedSettings);
     
     setupGui();
 }
 
 void testApp::exit() {
     camTracker.stopThread();
+    multiTracker.stopThreads();
+    faceLoader.stopThread();
+    motionAmplifier.setAsync(false);
 #ifdef USE_EDSDK
     cam.close();
 #endif
@@ -90,48 +130,98 @@ void testApp::update() {
     
     if(ofGetKeyPressed('a')) motionAmplifier.learningRate = .1;
     else motionAmplifier.learningRate = .9;
+    motionAmplifier.setAsync(motionAsync);
+    motionAmplifier.setGpuAccumulation(motionGpuAccumulation);
+    motionAmplifier.setSparse(motionSparse);
     
     camTracker.setRescale(trackerRescale);
+    camTracker.setFitInterval(trackerFitInterval);
+    camTracker.setRoi(trackerRoi);
     faceSubstitution.clone.setStrength(smoothestStep(substitutionTimer.get()) *substitutionStrength);
+    faceSubstitution.clone.setPrefixSumBlur(prefixSumBlur);
+    faceLoader.update();
     
 	cam.update();
 	if(cam.isFrameNew()) {
         camTimer.tick();
         
         // step 1: face tracking and optical flow on current image
-        camTracker.update(toCv(cam));
-        if(prevCam.getWidth()) {
+        if(multiFace) {
+            multiTracker.update(toCv(cam));
+            faceFound = multiTracker.getFound();
+        } else {
+            camTracker.update(toCv(cam));
+            faceFound = camTracker.getFound();
+        }
+        if(camHistory.size()) {
             motionAmplifier.update(cam);
         }
         
         // step 2: face sub onto present and future if possible
-        if(camTracker.getFound()) {
-            faceSubstitution.update(camTracker, prevCam, srcDelayPoints, srcDelay);
-            faceSubstitution.clone.getTexture().readToPixels(substitutionDelay);
-            substitutionDelay.setImageType(OF_IMAGE_COLOR);
-            slitScan.addImage(substitutionDelay);
-            faceSubstitution.update(camTracker, prevCam, srcOriginalPoints, srcOriginal);
+        if(faceFound) {
+            // 0 is the original, 1 the delay
+            vector<vector<ofVec2f>*> srcPoints;
+            vector<ofTexture*> srcs;
+            if(useFaceAtlas()) {
+                // with several faces, each one gets its own original from
+                // the same atlas page, so they're still drawn together
+                int faces = multiFace ? multiTracker.size() : 1;
+                vector<int> originals;
+                for(int i = 0; i < faces; i++) {
+                    originals.push_back(faceAtlas.getPageNeighbor(originalFace, i));
+                }
+                faceAtlas.getPoints(originals, atlasOriginalPoints);
+                srcPoints.push_back(&atlasOriginalPoints);
+                srcs.push_back(&faceAtlas.getTexture(originalFace));
+                srcPoints.push_back(&faceAtlas.getPoints(delayFace));
+                srcs.push_back(&faceAtlas.getTexture(delayFace));
+            } else {
+                srcPoints.push_back(&srcOriginalPoints);
+                srcs.push_back(&srcOriginal.getTexture());
+                srcPoints.push_back(&srcDelayPoints);
+                srcs.push_back(&srcDelay.getTexture());
+            }
+            if(multiFace) {
+                faceSubstitution.update(multiTracker.getImageMesh(), camHistory.get(), srcPoints, srcs);
+            } else {
+                faceSubstitution.update(camTracker, camHistory.get(), srcPoints, srcs);
+            }
+#ifdef USE_GPU_SLITSCAN
+            slitScan.addImage(faceSubstitution.clone.getTexture(1));
+#else
+            // arrives a frame or two late, but never stalls on the gpu
+            delayReadback.submit(faceSubstitution.clone.getFbo(1));
+            if(delayReadback.update(substitutionDelay)) {
+                slitScan.addImage(substitutionDelay);
+            }
+#endif
         } else {
-            slitScan.addImage(prevCam);
+#ifdef USE_GPU_SLITSCAN
+            slitScan.addImage(camHistory.get());
+#else
+            // a face frame still on its way back belongs before this one,
+            // it can't be added after a gap
+            delayReadback.cancel();
+            slitScan.addImage(camHistory.getPixels());
+#endif
         }
         
         // step 3: motion amplification
         if(motionAmplifier.strength > 0) {
-            amplifiedMotionOriginal.begin();
-            if(camTracker.getFound()) {
-                motionAmplifier.draw(faceSubstitution.clone.getTexture());
+            vector<ofTexture*> sources(2);
+            if(faceFound) {
+                sources[0] = &faceSubstitution.clone.getTexture();
             } else {
-                motionAmplifier.draw(prevCam);
+                sources[0] = &camHistory.getTexture();
             }
-            amplifiedMotionOriginal.end();
-            
-            amplifiedMotionDelay.begin();
-            motionAmplifier.draw(slitScan.getOutputImage());
-            amplifiedMotionDelay.end();
+            sources[1] = &slitScan.getOutputImage().getTexture();
+            amplifiedMotion.begin();
+            amplifiedMotion.activateAllDrawBuffers();
+            motionAmplifier.draw(sources);
+            amplifiedMotion.end();
         }
         
-        copy(cam, prevCam);
-        prevCam.update();
+        camHistory.push(cam);
         
         if(delaySync.tick()) {
             float delayFrames = MIN(delaySeconds * camTimer.getFrameRate(), slitScan.getCapacity());
@@ -154,10 +244,10 @@ void testApp::draw() {
     ofTexture* right;
     
     if(motionAmplifier.strength != 0) {
-        left = &amplifiedMotionOriginal.getTexture();
-        right = &amplifiedMotionDelay.getTexture();
+        left = &amplifiedMotion.getTexture(0);
+        right = &amplifiedMotion.getTexture(1);
     } else {
-        if(camTracker.getFound()) {
+        if(faceFound) {
             left = &faceSubstitution.clone.getTexture();
         } else {
             left = &cam.getTexture();
@@ -185,11 +275,22 @@ void testApp::draw() {
     }
     
     if(debug) {
-        camTracker.draw();
+        if(multiFace) {
+            multiTracker.draw();
+        } else {
+            camTracker.draw();
+        }
+        ofDrawBitmapStringHighlight("flow staleness " + ofToString(motionAmplifier.getStaleness()), 10, 20);
+#ifndef USE_GPU_SLITSCAN
+        ofDrawBitmapStringHighlight("readback latency " + ofToString(delayReadback.getLatency()) +
+                                    " dropped " + ofToString(delayReadback.getDropped()), 10, 40);
+#endif
+        ofDrawBitmapStringHighlight("face cache hits " + ofToString(faceLoader.getHits()) +
+                                    " misses " + ofToString(faceLoader.getMisses()), 10, 60);
         ofScale(.2, .2);
-        faceSubstitution.maskFbo.draw(0, 0);
+        faceSubstitution.getMaskTexture().draw(0, 0);
         ofTranslate(0, cam.getHeight());
-        faceSubstitution.srcFbo.draw(0, 0);
+        faceSubstitution.getSrcTexture().draw(0, 0);
         ofTranslate(0, cam.getHeight());
         ofScale(1./motionAmplifier.getRescale(), 1./motionAmplifier.getRescale());
         motionAmplifier.getFlowTexture().draw(0, 0);
@@ -198,11 +299,59 @@ void testApp::draw() {
     ofPopMatrix();
 }
 
+// a face dropped on the window is only in srcOriginal, so it turns the atlas
+// off until the next pair
+bool testApp::useFaceAtlas() {
+    return faceAtlasMode && !droppedFace && faceAtlas.getPages() > 0 &&
+        faceAtlas.getPage(originalFace) >= 0 && faceAtlas.getPage(delayFace) >= 0;
+}
+
+// the first library face from i on that has a mesh and an image
+int testApp::getValidFace(int i) {
+    int n = faceLibrary.size();
+    for(int j = 0; j < n; j++) {
+        int face = (i + j) % n;
+        if(faceLibrary.isValid(face)) {
+            return face;
+        }
+    }
+    return i % n;
+}
+
 void testApp::loadNextPair() {
-    loadFace(faceMeshes.getFile(currentFace), srcOriginal, srcOriginalPoints);
-    currentFace = (currentFace + 1) % faceMeshes.size();
-    loadFace(faceMeshes.getFile(currentFace), srcDelay, srcDelayPoints);
-    currentFace = (currentFace + 1) % faceMeshes.size();
+    droppedFace = false;
+    if(faceLibrary.size()) {
+        originalFace = getValidFace(currentFace);
+        delayFace = getValidFace(originalFace + 1);
+        currentFace = (delayFace + 1) % faceLibrary.size();
+        // loaded even when the atlas has them, so turning the atlas off
+        // shows the same pair
+        loadFace(originalFace, srcOriginal, srcOriginalPoints);
+        loadFace(delayFace, srcDelay, srcDelayPoints);
+        return;
+    }
+    // the textures are shared with the loader's cache, not copied
+    FaceLoader::Face& original = faceLoader.get(currentFace);
+    srcOriginal.getTexture() = original.texture;
+    srcOriginalPoints = original.points;
+    currentFace = (currentFace + 1) % faceLoader.size();
+    FaceLoader::Face& delay = faceLoader.get(currentFace);
+    srcDelay.getTexture() = delay.texture;
+    srcDelayPoints = delay.points;
+    currentFace = (currentFace + 1) % faceLoader.size();
+    faceLoader.prefetch(currentFace);
+}
+
+// the pixels are uploaded straight from the mapped library, src only keeps
+// the texture
+void testApp::loadFace(int i, ofImage& src, vector<ofVec2f>& srcPoints) {
+    const FaceLibrary::Face& face = faceLibrary.get(i);
+    srcPoints.assign(face.points, face.points + face.numPoints);
+    ofTexture& texture = src.getTexture();
+    if(texture.getWidth() != face.width || texture.getHeight() != face.height) {
+        texture.allocate(face.width, face.height, GL_RGB);
+    }
+    texture.loadData(face.pixels, face.width, face.height, GL_RGB);
 }
 
 void testApp::loadFace(ofFile faceMesh, ofImage& src, vector<ofVec2f>& srcPoints){
@@ -213,11 +362,14 @@ void testApp::loadFace(ofFile faceMesh, ofImage& src, vector<ofVec2f>& srcPoints
         srcPoints.push_back(vertex);
     }
     string faceImage = "faces/" + faceMesh.getBaseName() + ".jpg";
+    // src might share its texture with the face loader's cache
+    src.clear();
     src.load(faceImage);
 }
 
 void testApp::dragEvent(ofDragInfo dragInfo) {
 	loadFace(dragInfo.files[0], srcOriginal, srcOriginalPoints);
+    droppedFace = true;
 }
 
 int startX, startY;
@@ -259,5 +411,9 @@ void testApp::keyPressed(int key){
         loadNextPair();
         substitutionTimer.start();
     }
+    if(key == 'c') {
+        float difference = faceSubstitution.clone.compareBlurModes(faceSubstitution.getSrcTexture(), faceSubstitution.getMaskTexture());
+        ofLog() << "blur mode difference: " << difference;
+    }
 }
 
@@ -2,6 +2,7 @@
 
 //#define USE_VIDEO
 //#define USE_EDSDK
+#define USE_GPU_SLITSCAN
 
 #include "ofMain.h"
 #include "ofxSlitScan.h"
@@ -12,6 +13,14 @@
 #include "ofxTiming.h"
 
 #include "MotionAmplifier.h"
+#include "MultiFaceTracker.h"
+#include "PropagatedFaceTracker.h"
+#include "GpuSlitScan.h"
+#include "AsyncReadback.h"
+#include "FrameHistory.h"
+#include "FaceLibrary.h"
+#include "FaceLoader.h"
+#include "FaceAtlas.h"
 #include "FaceSubstitution.h"
 
 class testApp : public ofBaseApp {
@@ -22,8 +31,11 @@ public:
 	void update();
 	void draw();
 	void dragEvent(ofDragInfo dragInfo);
+    bool useFaceAtlas();
+    int getValidFace(int i);
     void loadNextPair();
 	void loadFace(ofFile face, ofImage& src, vector<ofVec2f>& srcPoints);
+    void loadFace(int i, ofImage& src, vector<ofVec2f>& srcPoints);
 	
     void mousePressed(int x, int y, int button);
     void mouseDragged(int x, int y, int button);
@@ -33,7 +45,13 @@ public:
     float maxOffset;
     float motionMax;
     float trackerRescale;
+    float trackerFitInterval;
+    bool trackerRoi;
     float substitutionStrength;
+    bool motionAsync, motionGpuAccumulation, motionSparse;
+    bool prefixSumBlur;
+    bool multiFace, faceFound;
+    bool faceAtlasMode, droppedFace;
     bool debug;
     
 #ifdef USE_VIDEO
@@ -45,24 +63,36 @@ public:
         ofVideoGrabber cam;
     #endif
 #endif
-    ofImage prevCam;
+    // the previous frame is camHistory.get() until the new one is pushed
+    FrameHistory camHistory;
     
     ofxEdsdk::RateTimer camTimer;
     
     // face tracking, face substitution
-	ofxFaceTrackerThreaded camTracker;
+	PropagatedFaceTracker camTracker;
+	MultiFaceTracker multiTracker;
     FaceSubstitution faceSubstitution;
     ofPixels substitutionDelay;
     FadeTimer substitutionTimer;
     
 	ofDirectory faceMeshes;
+    FaceLibrary faceLibrary;
+    FaceLoader faceLoader;
+    FaceAtlas faceAtlas;
+    int originalFace, delayFace;
+    vector<ofVec2f> atlasOriginalPoints;
 	int currentFace;
 	ofImage srcOriginal, srcDelay;
 	vector<ofVec2f> srcOriginalPoints;
 	vector<ofVec2f> srcDelayPoints;
     
     // delay
+#ifdef USE_GPU_SLITSCAN
+    GpuSlitScan slitScan;
+#else
     ofxSlitScan slitScan;
+    AsyncReadback delayReadback;
+#endif
     DelayTimer delaySync;
     float delaySeconds;
     
@@ -74,6 +104,5 @@ public:
     
     // motion amplification
     MotionAmplifier motionAmplifier;
-    ofFbo amplifiedMotionOriginal;
-    ofFbo amplifiedMotionDelay;
+    ofFbo amplifiedMotion;
 };
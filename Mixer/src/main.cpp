@@ -63,6 +63,9 @@ public:
     ofxUISlider* motionSlider;
     ofxUISlider* smoothedMotionSlider;
     
+    bool sendMotionGrid = false;
+    const int motionGridCols = 8, motionGridRows = 4;
+    
     ofVec2f bodyCenter;
     
     void loadScene1() {
@@ -144,6 +147,7 @@ public:
         gui->addSlider("Motion Smoothing-", 0, 1, &motionSmoothingDown);
         gui->addSlider("Motion min", 0, motionRange, &motionMin);
         gui->addSlider("Motion max", 0, motionRange, &motionMax);
+        gui->addToggle("Send motion grid", &sendMotionGrid);
         gui->autoSizeToFitWidgets();
         keyPressed('\t');
     }
@@ -208,6 +212,25 @@ public:
         float t = ofGetElapsedTimef();
         msg.addFloatArg(motionValue);
         osc.sendMessage(msg);
+        
+        // per region motion for spatialized sound, one pass for all cells.
+        // nothing is sent until there's a frame to compare against.
+        if(sendMotionGrid) {
+            motion.setGrid(motionGridCols, motionGridRows);
+            motion.update(graySmall);
+        }
+        if(sendMotionGrid && motion.isGridReady()) {
+            const vector<float>& cells = motion.getGridMean();
+            ofxOscMessage gridMsg;
+            gridMsg.setAddress("/motion/grid");
+            gridMsg.addIntArg(motion.getGridCols());
+            gridMsg.addIntArg(motion.getGridRows());
+            for(int i = 0; i < cells.size(); i++) {
+                gridMsg.addFloatArg(cells[i]);
+            }
+            osc.sendMessage(gridMsg);
+        }
+        
         if(motionValue > smoothedMotionValue) {
             smoothedMotionValue = ofLerp(motionValue, smoothedMotionValue, motionSmoothingUp);
         } else {
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "ofMain.h"
+#include <thread>
+#include "ofxCv.h"
+#include "ofxFaceTracker.h"
+
+// fits the crowd faces without a window, on several threads. every worker
+// has its own tracker and takes the next image from a shared index. the
+// tracker settings and the fit are the same functions the interactive app
+// uses, so the meshes come out the same.
+class CrowdBatch {
+public:
+    static void listFaces(ofDirectory& dir) {
+        dir.allowExt("png");
+        dir.allowExt("jpg");
+        dir.allowExt("tiff");
+        dir.listDir("faces");
+    }
+    
+    static void setupTracker(ofxFaceTracker& tracker) {
+        tracker.setup();
+        tracker.setRescale(.5);
+        tracker.setIterations(1);
+        tracker.setClamp(4);
+        tracker.setTolerance(.01);
+        tracker.setAttempts(4);
+    }
+    
+    static string getMeshName(ofFile file) {
+        return "meshes/" + file.getBaseName() + ".ply";
+    }
+    
+    static void fitFace(ofxFaceTracker& tracker, cv::Mat image, int iterations = 30) {
+        tracker.reset();
+        for(int i = 0; i < iterations; i++) {
+            tracker.update(image);
+        }
+    }
+    
+protected:
+    class Worker : public ofThread {
+    public:
+        CrowdBatch* batch;
+        ofxFaceTracker tracker;
+        
+        void threadedFunction() {
+            int index;
+            while(isThreadRunning() && batch->next(index)) {
+                batch->process(tracker, index);
+            }
+        }
+    };
+    
+    ofDirectory dir;
+    vector<shared_ptr<Worker> > workers;
+    ofMutex mutex;
+    int nextIndex, fitted, skipped, failed;
+    
+    bool next(int& index) {
+        ofScopedLock lock(mutex);
+        if(nextIndex >= dir.size()) {
+            return false;
+        }
+        index = nextIndex++;
+        return true;
+    }
+    
+    void process(ofxFaceTracker& tracker, int index) {
+        ofFile file = dir.getFile(index);
+        string meshName = getMeshName(file);
+        int* count = &fitted;
+        ofPixels pixels;
+        if(ofFile(meshName).exists()) {
+            count = &skipped;
+        } else if(!ofLoadImage(pixels, file.path())) {
+            count = &failed;
+        } else {
+            fitFace(tracker, ofxCv::toCv(pixels));
+            tracker.getImageMesh().save(meshName);
+        }
+        ofScopedLock lock(mutex);
+        (*count)++;
+    }
+    
+public:
+    CrowdBatch()
+    :nextIndex(0)
+    ,fitted(0)
+    ,skipped(0)
+    ,failed(0) {
+    }
+    
+    // blocks until every face is done, logging progress every second
+    void run(int threads = 0) {
+        if(threads <= 0) {
+            threads = MAX(1, (int) std::thread::hardware_concurrency());
+        }
+        listFaces(dir);
+        ofLogNotice("CrowdBatch") << dir.size() << " faces on " << threads << " threads";
+        
+        for(int i = 0; i < threads; i++) {
+            workers.push_back(shared_ptr<Worker>(new Worker()));
+            workers.back()->batch = this;
+            // the trackers load their models one at a time
+            setupTracker(workers.back()->tracker);
+        }
+        uint64_t start = ofGetElapsedTimeMillis();
+        for(int i = 0; i < workers.size(); i++) {
+            workers[i]->startThread();
+        }
+        
+        while(true) {
+            ofSleepMillis(1000);
+            mutex.lock();
+            int done = fitted + skipped + failed;
+            float seconds = (ofGetElapsedTimeMillis() - start) / 1000.;
+            float rate = fitted / seconds;
+            int remaining = dir.size() - done;
+            ofLogNotice("CrowdBatch") << done << "/" << dir.size() << " "
+                << ofToString(rate, 1) << " faces/s "
+                << (rate > 0 ? (int) (remaining / rate) : 0) << "s left";
+            mutex.unlock();
+            if(remaining == 0) {
+                break;
+            }
+        }
+        
+        for(int i = 0; i < workers.size(); i++) {
+            workers[i]->waitForThread(true);
+        }
+        ofLogNotice("CrowdBatch") << fitted << " fitted, " << skipped << " already done, " << failed << " unreadable";
+    }
+};
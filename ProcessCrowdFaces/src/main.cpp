@@ -1,7 +1,26 @@
 #include "testApp.h"
 #include "ofAppGlutWindow.h"
 
-int main() {
+// --batch fits every face without a window, --threads n picks the thread
+// count (one per core by default)
+int main(int argc, char** argv) {
+	vector<string> args(argv + 1, argv + argc);
+	if(find(args.begin(), args.end(), "--batch") != args.end()) {
+		// the data path is relative to the app, not to where it was run from,
+		// ofRunApp() would normally take care of this
+		ofSetWorkingDirectoryToDefault();
+		ofSetDataPathRoot("../../../../../SharedData/");
+		int threads = 0;
+		vector<string>::iterator it = find(args.begin(), args.end(), "--threads");
+		if(it != args.end() && it + 1 != args.end()) {
+			threads = ofToInt(*(it + 1));
+		}
+		CrowdBatch batch;
+		batch.run(threads);
+		FaceLibrary::build("meshes", "faces", "faces.bin");
+		return 0;
+	}
+	
 	ofAppGlutWindow window;
 	ofSetupOpenGL(&window, 1280, 720, OF_WINDOW);
 	ofRunApp(new testApp());
@@ -4,17 +4,9 @@ using namespace ofxCv;
 
 void testApp::setup() {
     ofSetDataPathRoot("../../../../../SharedData/");
-    dir.allowExt("png");
-    dir.allowExt("jpg");
-    dir.allowExt("tiff");
-    dir.listDir("faces");
+    CrowdBatch::listFaces(dir);
     index = 0;
-	tracker.setup();
-    tracker.setRescale(.5);
-    tracker.setIterations(1);
-    tracker.setClamp(4);
-    tracker.setTolerance(.01);
-    tracker.setAttempts(4);
+    CrowdBatch::setupTracker(tracker);
     iterations = 30;
     done = false;
     glPointSize(2);
@@ -24,10 +16,7 @@ void testApp::setup() {
 void testApp::loadImage() {
     img.load(dir.getPath(index));
     if(!loadFace()) {
-        tracker.reset();
-        for(int i = 0; i < iterations; i++) {
-            tracker.update(toCv(img));
-        }
+        CrowdBatch::fitFace(tracker, toCv(img), iterations);
         saveFace();
         timer.tick();
     }
@@ -35,14 +24,11 @@ void testApp::loadImage() {
 
 void testApp::saveFace() {
     ofMesh mesh = tracker.getImageMesh();
-    string baseName = dir.getFile(index).getBaseName();
-    string meshName = "meshes/" + baseName + ".ply";
-    mesh.save(meshName);
+    mesh.save(CrowdBatch::getMeshName(dir.getFile(index)));
 }
 
 bool testApp::loadFace() {
-    string baseName = dir.getFile(index).getBaseName();
-    string meshName = "meshes/" + baseName + ".ply";
+    string meshName = CrowdBatch::getMeshName(dir.getFile(index));
     if(ofFile(meshName).exists()) {
         prevFace.load(meshName);
         return true;
@@ -59,14 +45,18 @@ void testApp::keyPressed(int key) {
         index = ofClamp(index + 1, 0, dir.size() - 1);
         loadImage();
     }
+    if(key == 'b') {
+        FaceLibrary::build("meshes", "faces", "faces.bin");
+    }
 }
 
 void testApp::update() {
     if(!done && index < dir.size()) {
         loadImage();
         index++;
-    } else {
+    } else if(!done) {
         done = true;
+        FaceLibrary::build("meshes", "faces", "faces.bin");
     }
 }
 
@@ -5,6 +5,8 @@
 
 #include "ofxFaceTracker.h"
 #include "ofxTiming.h"
+#include "FaceLibrary.h"
+#include "CrowdBatch.h"
 
 class testApp : public ofBaseApp {
 public:
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "ofMain.h"
+
+// reads an fbo back to the cpu without waiting for the gpu. each submit()
+// starts a glReadPixels into the next pixel buffer object of a ring and
+// puts a fence behind it, and update() copies out the newest readback whose
+// fence has passed. results arrive a frame or two late. a readback that is
+// still in flight when its buffer comes around again is dropped, and so is
+// one that finishes but is overtaken by a newer one.
+class AsyncReadback {
+protected:
+    struct Slot {
+        GLuint pbo;
+        GLsync fence;
+        int frame;
+    };
+    
+    vector<Slot> slots;
+    int width, height, channels;
+    GLenum format;
+    int head, submitted, latency, dropped;
+    
+    void release(Slot& slot) {
+        if(slot.fence) {
+            glDeleteSync(slot.fence);
+            slot.fence = 0;
+        }
+    }
+
+public:
+    AsyncReadback()
+    :width(0)
+    ,height(0)
+    ,channels(0)
+    ,format(GL_RGB)
+    ,head(0)
+    ,submitted(0)
+    ,latency(0)
+    ,dropped(0) {
+    }
+    
+    ~AsyncReadback() {
+        for(int i = 0; i < slots.size(); i++) {
+            release(slots[i]);
+            glDeleteBuffers(1, &slots[i].pbo);
+        }
+    }
+    
+    void setup(int width, int height, int channels = 3, int size = 3) {
+        this->width = width;
+        this->height = height;
+        this->channels = channels;
+        format = channels == 4 ? GL_RGBA : channels == 1 ? GL_RED : GL_RGB;
+        slots.resize(size);
+        for(int i = 0; i < size; i++) {
+            glGenBuffers(1, &slots[i].pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, width * height * channels, NULL, GL_STREAM_READ);
+            slots[i].fence = 0;
+            slots[i].frame = 0;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    
+    void submit(ofFbo& fbo, int attachment = 0) {
+        Slot& slot = slots[head];
+        head = (head + 1) % slots.size();
+        if(slot.fence) {
+            release(slot);
+            dropped++;
+        }
+        
+        fbo.bind();
+        glReadBuffer(GL_COLOR_ATTACHMENT0 + attachment);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        // orphan the old storage so the driver never waits on it
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * channels, NULL, GL_STREAM_READ);
+        glReadPixels(0, 0, width, height, format, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fbo.unbind();
+        
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.frame = submitted++;
+    }
+    
+    // copies the newest finished readback into pixels, false if none finished
+    bool update(ofPixels& pixels) {
+        Slot* newest = NULL;
+        for(int i = 0; i < slots.size(); i++) {
+            Slot& slot = slots[(head + i) % slots.size()];
+            if(!slot.fence) {
+                continue;
+            }
+            GLenum status = glClientWaitSync(slot.fence, 0, 0);
+            if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                continue;
+            }
+            release(slot);
+            if(newest != NULL) {
+                dropped++;
+            }
+            newest = &slot;
+        }
+        if(newest == NULL) {
+            return false;
+        }
+        
+        pixels.allocate(width, height, channels);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, newest->pbo);
+        unsigned char* data = (unsigned char*) glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if(data != NULL) {
+            memcpy(pixels.getData(), data, width * height * channels);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        latency = submitted - newest->frame;
+        return data != NULL;
+    }
+    
+    // drops every readback that's still in flight or unread, so the next
+    // update() can't return a frame from before the call
+    void cancel() {
+        for(int i = 0; i < slots.size(); i++) {
+            if(slots[i].fence) {
+                release(slots[i]);
+                dropped++;
+            }
+        }
+    }
+    
+    // how many submits ago the last returned readback was started
+    int getLatency() const {
+        return latency;
+    }
+    
+    int getDropped() const {
+        return dropped;
+    }
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "ofMain.h"
+#include "FaceLibrary.h"
+
+// every face of a FaceLibrary packed into a few big textures, with the
+// landmarks moved to where each face landed. picking a face is just picking
+// its page and points, and faces on the same page can be drawn together.
+class FaceAtlas {
+protected:
+    struct Face {
+        int page;
+        vector<ofVec2f> points;
+    };
+    
+    vector<ofTexture> pages;
+    vector<vector<int> > pageFaces;
+    vector<Face> faces;
+    
+    // keeps linear filtering from bleeding between neighbours
+    static const int spacing = 2;
+    
+    void upload(ofTexture& page, const FaceLibrary::Face& face, int x, int y) {
+        GLenum format = face.channels == 4 ? GL_RGBA : GL_RGB;
+        ofTextureData& data = page.getTextureData();
+        glBindTexture(data.textureTarget, data.textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(data.textureTarget, 0, x, y, face.width, face.height, format, GL_UNSIGNED_BYTE, face.pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(data.textureTarget, 0);
+    }
+    
+    // shelf packing leaves some of each page empty
+    static float getPackingEfficiency() {
+        return .8;
+    }
+    
+    // allocate() leaves the texels undefined, and the spacing between faces
+    // is sampled at their edges. one clear through a temporary framebuffer.
+    void clear(ofTexture& page) {
+        ofTextureData& data = page.getTextureData();
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, data.textureTarget, data.textureID, 0);
+        ofClear(0, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+    }
+    
+public:
+    // shelf packs the faces in library order. the pages are only as big as
+    // the faces need, up to pageSize, and with maxPages 0 there are as many
+    // as the total face area needs. faces that don't fit in maxPages pages
+    // are left out, getPage() is -1 for them.
+    void setup(const FaceLibrary& library, int pageSize = 4096, int maxPages = 0) {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_RECTANGLE_TEXTURE_SIZE_ARB, &maxSize);
+        if(maxSize > 0) {
+            pageSize = MIN(pageSize, maxSize);
+        }
+        
+        double area = 0;
+        int largest = 0;
+        for(int i = 0; i < library.size(); i++) {
+            const FaceLibrary::Face& face = library.get(i);
+            if(library.isValid(i)) {
+                area += (face.width + spacing) * (face.height + spacing);
+                largest = MAX(largest, MAX(face.width, face.height));
+            }
+        }
+        area /= getPackingEfficiency();
+        // a small library gets one page that's just big enough, in steps of
+        // 256 so there's room to spare
+        int side = ceil(sqrt(area) / 256) * 256;
+        pageSize = MIN(pageSize, MAX(side, largest));
+        if(maxPages <= 0) {
+            // one extra for what the estimate misses, pages are only
+            // allocated once a face needs them
+            maxPages = ceil(area / ((double) pageSize * pageSize)) + 1;
+        }
+        
+        pages.clear();
+        pageFaces.clear();
+        faces.assign(library.size(), Face());
+        int x = 0, y = 0, shelfHeight = 0, skipped = 0;
+        for(int i = 0; i < library.size(); i++) {
+            const FaceLibrary::Face& face = library.get(i);
+            faces[i].page = -1;
+            if(!library.isValid(i)) {
+                continue;
+            }
+            if(face.width > pageSize || face.height > pageSize) {
+                skipped++;
+                continue;
+            }
+            if(x + face.width > pageSize) {
+                x = 0;
+                y += shelfHeight + spacing;
+                shelfHeight = 0;
+            }
+            if(pages.empty() || y + face.height > pageSize) {
+                if(pages.size() == maxPages) {
+                    skipped++;
+                    continue;
+                }
+                pages.push_back(ofTexture());
+                pages.back().allocate(pageSize, pageSize, GL_RGB);
+                clear(pages.back());
+                pageFaces.push_back(vector<int>());
+                x = 0;
+                y = 0;
+                shelfHeight = 0;
+            }
+            
+            upload(pages.back(), face, x, y);
+            faces[i].page = pages.size() - 1;
+            faces[i].points.resize(face.numPoints);
+            for(int j = 0; j < face.numPoints; j++) {
+                faces[i].points[j] = face.points[j] + ofVec2f(x, y);
+            }
+            pageFaces.back().push_back(i);
+            
+            x += face.width + spacing;
+            shelfHeight = MAX(shelfHeight, face.height);
+        }
+        if(skipped > 0) {
+            ofLogWarning("FaceAtlas") << skipped << " faces didn't fit in " << maxPages << " pages";
+        }
+        ofLogNotice("FaceAtlas") << pages.size() << " pages of " << pageSize << "x" << pageSize << ", "
+            << (pages.size() * pageSize * pageSize * 3) / (1 << 20) << "MB";
+    }
+    
+    int size() const {
+        return faces.size();
+    }
+    
+    int getPages() const {
+        return pages.size();
+    }
+    
+    // -1 when the face didn't fit
+    int getPage(int face) const {
+        return faces[face].page;
+    }
+    
+    ofTexture& getTexture(int face) {
+        return pages[faces[face].page];
+    }
+    
+    vector<ofVec2f>& getPoints(int face) {
+        return faces[face].points;
+    }
+    
+    // the k-th face after face on the same page, so they can share a draw
+    int getPageNeighbor(int face, int k) const {
+        const vector<int>& page = pageFaces[faces[face].page];
+        int i = find(page.begin(), page.end(), face) - page.begin();
+        return page[(i + k) % page.size()];
+    }
+    
+    // the points of several faces one after another, for a mesh that holds
+    // that many faces. false if they aren't all on one page.
+    bool getPoints(const vector<int>& faceIndices, vector<ofVec2f>& points) {
+        points.clear();
+        for(int i = 0; i < faceIndices.size(); i++) {
+            Face& face = faces[faceIndices[i]];
+            if(face.page != faces[faceIndices[0]].page) {
+                return false;
+            }
+            points.insert(points.end(), face.points.begin(), face.points.end());
+        }
+        return true;
+    }
+};
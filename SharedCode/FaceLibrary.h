@@ -0,0 +1,224 @@
+#pragma once
+
+#include "ofMain.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// all the source faces in one file: the landmarks and the decoded pixels of
+// each face, cropped to the landmarks. build() writes it from the meshes and
+// faces folders, load() maps it into memory, so getting a face doesn't parse
+// or decode anything. there's an entry for every mesh in sorted order, so
+// index i is the i-th mesh. a mesh without an image or vertices has an
+// empty entry, with no points and no pixels.
+class FaceLibrary {
+public:
+    struct Face {
+        string name;
+        const ofVec2f* points;
+        int numPoints;
+        const unsigned char* pixels;
+        int width, height, channels;
+    };
+    
+protected:
+    struct Header {
+        char magic[4];
+        uint32_t version, count, reserved;
+    };
+    
+    struct Entry {
+        char name[64];
+        uint32_t numPoints, width, height, channels;
+        uint64_t pointsOffset, pixelsOffset;
+    };
+    
+    static const int version = 1;
+    
+    void* data;
+    size_t dataSize;
+    vector<Face> faces;
+    
+    static uint64_t align(uint64_t offset) {
+        return (offset + 15) & ~15;
+    }
+    
+public:
+    FaceLibrary()
+    :data(NULL)
+    ,dataSize(0) {
+    }
+    
+    ~FaceLibrary() {
+        close();
+    }
+    
+    // faces are only sampled inside the mesh, so the crop keeps margin
+    // pixels around the landmarks. each face is written as soon as it's
+    // cropped, and the header and the entry table go in last, so only one
+    // face is in memory at a time.
+    static bool build(string meshDir, string faceDir, string path, int margin = 8) {
+        ofDirectory meshes;
+        meshes.allowExt("ply");
+        meshes.listDir(meshDir);
+        meshes.sort();
+        
+        ofstream out(ofToDataPath(path).c_str(), ios::binary);
+        if(!out) {
+            ofLogError("FaceLibrary") << "can't write " << path;
+            return false;
+        }
+        
+        vector<Entry> entries(meshes.size());
+        uint64_t offset = align(sizeof(Header) + meshes.size() * sizeof(Entry));
+        int faces = 0;
+        for(int i = 0; i < meshes.size(); i++) {
+            ofFile meshFile = meshes.getFile(i);
+            Entry& entry = entries[i];
+            memset(&entry, 0, sizeof(entry));
+            strncpy(entry.name, meshFile.getBaseName().c_str(), sizeof(entry.name) - 1);
+            // pixels rather than an ofImage, so it works without a gl context
+            ofPixels img;
+            if(!ofLoadImage(img, faceDir + "/" + meshFile.getBaseName() + ".jpg")) {
+                ofLogWarning("FaceLibrary") << "no image for " << meshFile.getFileName();
+                continue;
+            }
+            ofMesh mesh;
+            mesh.load(meshFile.path());
+            if(mesh.getNumVertices() == 0) {
+                continue;
+            }
+            
+            ofRectangle crop(mesh.getVertex(0), 0, 0);
+            for(int j = 1; j < mesh.getNumVertices(); j++) {
+                crop.growToInclude(mesh.getVertex(j));
+            }
+            crop.x = floor(crop.x) - margin;
+            crop.y = floor(crop.y) - margin;
+            crop.width = ceil(crop.width) + 2 * margin;
+            crop.height = ceil(crop.height) + 2 * margin;
+            crop = crop.getIntersection(ofRectangle(0, 0, img.getWidth(), img.getHeight()));
+            
+            entry.numPoints = mesh.getNumVertices();
+            entry.width = crop.width;
+            entry.height = crop.height;
+            entry.channels = 3;
+            
+            vector<ofVec2f> points;
+            for(int j = 0; j < mesh.getNumVertices(); j++) {
+                ofVec3f& vertex = mesh.getVertices()[j];
+                points.push_back(ofVec2f(vertex.x - crop.x, vertex.y - crop.y));
+            }
+            entry.pointsOffset = offset;
+            out.seekp(offset);
+            out.write((const char*) &points[0], points.size() * sizeof(ofVec2f));
+            offset = align(offset + entry.numPoints * sizeof(ofVec2f));
+            
+            ofPixels pixels;
+            img.setImageType(OF_IMAGE_COLOR);
+            img.cropTo(pixels, crop.x, crop.y, crop.width, crop.height);
+            entry.pixelsOffset = offset;
+            out.seekp(offset);
+            out.write((const char*) pixels.getData(), pixels.size());
+            offset = align(offset + entry.width * entry.height * entry.channels);
+            faces++;
+        }
+        
+        if(faces == 0) {
+            ofLogError("FaceLibrary") << "no faces to write to " << path;
+            return false;
+        }
+        // pad the file out to the aligned end of the last face
+        out.seekp(offset - 1);
+        out.put(0);
+        Header header = {{'F', 'L', 'I', 'B'}, version, (uint32_t) entries.size(), 0};
+        out.seekp(0);
+        out.write((const char*) &header, sizeof(header));
+        out.write((const char*) &entries[0], entries.size() * sizeof(Entry));
+        ofLogNotice("FaceLibrary") << "wrote " << faces << " of " << entries.size() << " faces to " << path;
+        return out.good();
+    }
+    
+    bool load(string path) {
+        close();
+        int fd = open(ofToDataPath(path).c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if(fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(Header)) {
+            dataSize = info.st_size;
+            data = mmap(NULL, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(data == MAP_FAILED) {
+                data = NULL;
+            }
+        }
+        ::close(fd);
+        if(data == NULL) {
+            return false;
+        }
+        
+        const unsigned char* bytes = (const unsigned char*) data;
+        const Header* header = (const Header*) bytes;
+        if(memcmp(header->magic, "FLIB", 4) != 0 || header->version != version ||
+           sizeof(Header) + header->count * sizeof(Entry) > dataSize) {
+            ofLogError("FaceLibrary") << path << " isn't a face library";
+            close();
+            return false;
+        }
+        const Entry* entries = (const Entry*) (bytes + sizeof(Header));
+        faces.resize(header->count);
+        for(int i = 0; i < faces.size(); i++) {
+            const Entry& entry = entries[i];
+            if(entry.pointsOffset + entry.numPoints * sizeof(ofVec2f) > dataSize ||
+               entry.pixelsOffset + entry.width * entry.height * entry.channels > dataSize) {
+                ofLogError("FaceLibrary") << path << " is truncated";
+                close();
+                return false;
+            }
+            Face& face = faces[i];
+            face.name = string(entry.name, strnlen(entry.name, sizeof(entry.name)));
+            bool empty = entry.numPoints == 0;
+            face.points = empty ? NULL : (const ofVec2f*) (bytes + entry.pointsOffset);
+            face.numPoints = entry.numPoints;
+            face.pixels = empty ? NULL : bytes + entry.pixelsOffset;
+            face.width = entry.width;
+            face.height = entry.height;
+            face.channels = entry.channels;
+        }
+        return true;
+    }
+    
+    void close() {
+        if(data != NULL) {
+            munmap(data, dataSize);
+            data = NULL;
+            dataSize = 0;
+        }
+        faces.clear();
+    }
+    
+    int size() const {
+        return faces.size();
+    }
+    
+    const Face& get(int i) const {
+        return faces[i];
+    }
+    
+    // false for the entry of a mesh that had no image or no vertices
+    bool isValid(int i) const {
+        return faces[i].numPoints > 0;
+    }
+    
+    // -1 when there's no face with that name
+    int find(const string& name) const {
+        for(int i = 0; i < faces.size(); i++) {
+            if(faces[i].name == name) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
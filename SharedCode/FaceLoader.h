@@ -0,0 +1,279 @@
+#pragma once
+
+#include "ofMain.h"
+
+// loads source faces (a .ply of landmarks and a .jpg with the same name)
+// ahead of time. prefetch() asks a worker thread to decode the next few
+// faces in directory order. update() copies one decoded face per frame into
+// a pixel buffer, and starts the texture upload from it on the next frame,
+// so the upload doesn't wait for the copy. the uploaded faces stay in a
+// small lru cache. get() only loads on the spot when a face isn't ready,
+// which counts as a miss.
+class FaceLoader : public ofThread {
+public:
+    struct Face {
+        int index;
+        vector<ofVec2f> points;
+        ofTexture texture;
+    };
+    
+protected:
+    struct Decoded {
+        int index;
+        vector<ofVec2f> points;
+        ofPixels pixels;
+    };
+    
+    vector<string> meshPaths;
+    string faceDir;
+    
+    // shared with the worker
+    deque<int> requests;
+    deque<Decoded> decoded;
+    
+    // a face whose pixels are in a pixel buffer, waiting for its upload
+    struct Staged {
+        int index;
+        vector<ofVec2f> points;
+        int width, height;
+        GLint internalFormat;
+        GLenum format;
+    };
+    
+    // most recently used first
+    list<Face> cache;
+    set<int> pending;
+    
+    // update() fills one buffer while the other one's upload finishes
+    static const int pboCount = 2;
+    ofBufferObject pbos[pboCount];
+    int pboSizes[pboCount];
+    Staged staged;
+    int stagedPbo, nextPbo;
+    int capacity, lookahead, hits, misses;
+    
+    void decode(Decoded& face) {
+        ofFile meshFile(meshPaths[face.index]);
+        ofMesh mesh;
+        mesh.load(meshFile.path());
+        face.points.clear();
+        for(int i = 0; i < mesh.getNumVertices(); i++) {
+            face.points.push_back(mesh.getVertex(i));
+        }
+        ofLoadImage(face.pixels, faceDir + "/" + meshFile.getBaseName() + ".jpg");
+    }
+    
+    Face* find(int index) {
+        for(list<Face>::iterator it = cache.begin(); it != cache.end(); it++) {
+            if(it->index == index) {
+                // move it to the front
+                cache.splice(cache.begin(), cache, it);
+                return &cache.front();
+            }
+        }
+        return NULL;
+    }
+    
+    // a new face at the front of the cache, without a texture yet
+    Face& add(int index, vector<ofVec2f>& points) {
+        if(cache.size() >= (size_t) capacity) {
+            // a face that's still in use keeps its texture, ofTexture
+            // copies share the gl texture until the last one is gone
+            cache.pop_back();
+        }
+        cache.push_front(Face());
+        Face& front = cache.front();
+        front.index = index;
+        front.points.swap(points);
+        return front;
+    }
+    
+    // uploads right away, for faces that are needed this frame
+    Face& upload(Decoded& loaded) {
+        Face* face = find(loaded.index);
+        if(face != NULL) {
+            return *face;
+        }
+        Face& front = add(loaded.index, loaded.points);
+        if(loaded.pixels.isAllocated()) {
+            front.texture.loadData(loaded.pixels);
+        }
+        return front;
+    }
+    
+    // copies the pixels into the next pixel buffer. the driver can start
+    // moving them to the gpu right away, the texture reads them next frame.
+    void stage(Decoded& loaded) {
+        staged.index = loaded.index;
+        staged.points.swap(loaded.points);
+        ofPixels& pixels = loaded.pixels;
+        if(!pixels.isAllocated()) {
+            staged.width = 0;
+            staged.height = 0;
+            stagedPbo = -1;
+            return;
+        }
+        staged.width = pixels.getWidth();
+        staged.height = pixels.getHeight();
+        staged.internalFormat = ofGetGlInternalFormat(pixels);
+        staged.format = ofGetGlFormat(pixels);
+        
+        ofBufferObject& pbo = pbos[nextPbo];
+        int size = pixels.size();
+        if(pboSizes[nextPbo] < size) {
+            pbo.allocate(size, pixels.getData(), GL_STREAM_DRAW);
+            pboSizes[nextPbo] = size;
+        } else {
+            // the upload from it two frames ago might still be running.
+            // orphaning hands the old storage to the driver instead of
+            // waiting for it.
+            pbo.allocate(pboSizes[nextPbo], GL_STREAM_DRAW);
+            pbo.updateData(0, size, pixels.getData());
+        }
+        stagedPbo = nextPbo;
+        nextPbo = (nextPbo + 1) % pboCount;
+    }
+    
+    // moves the staged face into the cache, uploading from its buffer
+    void finishStaged() {
+        if(staged.index < 0) {
+            return;
+        }
+        int index = staged.index;
+        staged.index = -1;
+        pending.erase(index);
+        if(find(index) != NULL) {
+            return;
+        }
+        Face& front = add(index, staged.points);
+        if(stagedPbo >= 0) {
+            front.texture.allocate(staged.width, staged.height, staged.internalFormat);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            front.texture.loadData(pbos[stagedPbo], staged.format, GL_UNSIGNED_BYTE);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        }
+    }
+    
+    void threadedFunction() {
+        while(isThreadRunning()) {
+            lock();
+            bool hasRequest = !requests.empty();
+            Decoded face;
+            if(hasRequest) {
+                face.index = requests.front();
+                requests.pop_front();
+            }
+            unlock();
+            if(hasRequest) {
+                decode(face);
+                lock();
+                decoded.push_back(Decoded());
+                decoded.back().index = face.index;
+                decoded.back().points.swap(face.points);
+                decoded.back().pixels.swap(face.pixels);
+                unlock();
+            } else {
+                ofSleepMillis(5);
+            }
+        }
+    }
+    
+public:
+    FaceLoader()
+    :stagedPbo(-1)
+    ,nextPbo(0)
+    ,capacity(6)
+    ,lookahead(4)
+    ,hits(0)
+    ,misses(0) {
+        staged.index = -1;
+        for(int i = 0; i < pboCount; i++) {
+            pboSizes[i] = 0;
+        }
+    }
+    
+    ~FaceLoader() {
+        waitForThread(true);
+    }
+    
+    // the cache has room for the prefetched faces plus the two in use
+    void setup(ofDirectory& meshes, string faceDir = "faces", int lookahead = 4) {
+        meshPaths.clear();
+        for(int i = 0; i < meshes.size(); i++) {
+            meshPaths.push_back(meshes.getPath(i));
+        }
+        this->faceDir = faceDir;
+        this->lookahead = lookahead;
+        capacity = lookahead + 2;
+        startThread();
+    }
+    
+    int size() const {
+        return meshPaths.size();
+    }
+    
+    // queues the lookahead faces starting at index that aren't loaded yet
+    void prefetch(int index) {
+        if(meshPaths.empty()) {
+            return;
+        }
+        lock();
+        for(int i = 0; i < lookahead; i++) {
+            int next = (index + i) % meshPaths.size();
+            bool cached = false;
+            for(list<Face>::iterator it = cache.begin(); it != cache.end(); it++) {
+                cached = cached || it->index == next;
+            }
+            if(!cached && pending.insert(next).second) {
+                requests.push_back(next);
+            }
+        }
+        unlock();
+    }
+    
+    // uploads the face staged last frame and stages the next finished one,
+    // call it once a frame
+    void update() {
+        finishStaged();
+        
+        lock();
+        bool hasDecoded = !decoded.empty();
+        Decoded face;
+        if(hasDecoded) {
+            face.index = decoded.front().index;
+            face.points.swap(decoded.front().points);
+            face.pixels.swap(decoded.front().pixels);
+            decoded.pop_front();
+        }
+        unlock();
+        if(hasDecoded) {
+            stage(face);
+        }
+    }
+    
+    Face& get(int index) {
+        if(staged.index == index) {
+            finishStaged();
+        }
+        Face* face = find(index);
+        if(face != NULL) {
+            hits++;
+            return *face;
+        }
+        misses++;
+        // the worker might still decode it, but it's not waited for anymore
+        pending.erase(index);
+        Decoded loaded;
+        loaded.index = index;
+        decode(loaded);
+        return upload(loaded);
+    }
+    
+    int getHits() const {
+        return hits;
+    }
+    
+    int getMisses() const {
+        return misses;
+    }
+};
@@ -7,9 +7,18 @@
 class FaceSubstitution {
 public:
 	ofxFaceTracker tracker;
-	ofFbo srcFbo, maskFbo;
 	Clone clone;
     
+    // the mask is color buffer 0, source i is color buffer 1 + i. both are
+    // written by one draw of the cam mesh, with a texcoord attribute per source.
+    ofFbo faceFbo;
+    ofVbo faceVbo;
+    ofShader faceShader;
+    vector<ofVec2f> repeatedPoints[Clone::maxSources];
+    
+    // the region drawn last frame, which is all that needs clearing
+    ofRectangle lastRoi;
+    
     void setup(int width, int height) {
         clone.setup(width, height);
         
@@ -18,20 +27,61 @@ public:
         settings.height = height;
         settings.useDepth = false;
         settings.useStencil = false;
-        maskFbo.allocate(settings);
-        srcFbo.allocate(settings);
+        settings.numColorbuffers = 1 + Clone::maxSources;
+        faceFbo.allocate(settings);
+        faceShader.load("shaders/FaceSubstitution");
         
         tracker.setup();
         tracker.setIterations(30);
         tracker.setAttempts(4);
         
-        maskFbo.begin();
+        faceFbo.begin();
+        faceFbo.activateAllDrawBuffers();
         ofClear(0, 255);
-        maskFbo.end();
+        faceFbo.end();
         
-        srcFbo.begin();
-        ofClear(0, 255);
-        srcFbo.end();
+        lastRoi.set(0, 0, 0, 0);
+    }
+    // the mesh bounding box padded by the blur radius
+    ofRectangle getRoi(ofMesh& mesh) {
+        ofRectangle roi;
+        vector<ofVec3f>& vertices = mesh.getVertices();
+        if(!vertices.empty()) {
+            roi.set(vertices[0], 0, 0);
+            for(int i = 1; i < vertices.size(); i++) {
+                roi.growToInclude(vertices[i]);
+            }
+            float padding = clone.getStrength() + 1;
+            roi.x -= padding;
+            roi.y -= padding;
+            roi.width += 2 * padding;
+            roi.height += 2 * padding;
+        }
+        return roi;
+    }
+    ofTexture& getMaskTexture() {
+        return faceFbo.getTextureReference(0);
+    }
+    ofTexture& getSrcTexture(int i = 0) {
+        return faceFbo.getTextureReference(1 + i);
+    }
+    // a mesh with several faces one after another uses the same source
+    // points for each of them
+    ofVec2f* getTexCoords(vector<ofVec2f>& points, int vertices, int i) {
+        if(points.size() == vertices) {
+            return &points[0];
+        }
+        vector<ofVec2f>& repeated = repeatedPoints[i];
+        repeated.resize(vertices);
+        for(int j = 0; j < vertices; j++) {
+            repeated[j] = points[j % points.size()];
+        }
+        return &repeated[0];
+    }
+    void clearRect(ofRectangle& rect) {
+        ofSetColor(0);
+        ofDrawRectangle(rect);
+        ofSetColor(255);
     }
     template <class T>
     vector<ofVec2f> getSrcPoints(T& img) {
@@ -40,26 +90,108 @@ public:
         return tracker.getImagePoints();
     }
     void update(ofxFaceTracker& camTracker, ofBaseHasTexture& cam, vector<ofVec2f>& srcPoints, ofImage& src) {
+        vector<vector<ofVec2f>*> allSrcPoints(1, &srcPoints);
+        vector<ofImage*> srcs(1, &src);
+        update(camTracker, cam, allSrcPoints, srcs);
+    }
+    // srcs can be ofImage* or ofTexture*
+    template <class T>
+    void update(ofxFaceTracker& camTracker, ofBaseHasTexture& cam, vector<vector<ofVec2f>*>& srcPoints, vector<T*>& srcs) {
+        ofMesh camMesh = camTracker.getImageMesh();
+        update(camMesh, cam, srcPoints, srcs);
+    }
+    void update(ofMesh& camMesh, ofBaseHasTexture& cam, vector<vector<ofVec2f>*>& srcPoints, vector<ofImage*>& srcs) {
+        vector<ofTexture*> srcTextures(srcs.size());
+        for(int i = 0; i < srcs.size(); i++) {
+            srcTextures[i] = &srcs[i]->getTexture();
+        }
+        update(camMesh, cam, srcPoints, srcTextures);
+    }
+    // draws sources first to first + n - 1 of srcs into the color buffers
+    // 1 to n of faceFbo, and the mask into buffer 0
+    void drawSources(ofMesh& camMesh, vector<vector<ofVec2f>*>& srcPoints, vector<ofTexture*>& srcs, int first, int n, ofRectangle& dirty) {
+        int vertices = camMesh.getNumVertices();
+        faceVbo.setTexCoordData(getTexCoords(*srcPoints[first], vertices, 0), vertices, GL_DYNAMIC_DRAW);
+        for(int i = 1; i < n; i++) {
+            int location = faceShader.getAttributeLocation("srcCoord" + ofToString(i));
+            faceVbo.setAttributeData(location, &getTexCoords(*srcPoints[first + i], vertices, i)->x, 2, vertices, GL_DYNAMIC_DRAW);
+        }
+        // attributes an earlier call set for more sources stay enabled, and
+        // would be read past the end when the mesh has fewer vertices now
+        for(int i = n; i < Clone::maxSources; i++) {
+            int location = faceShader.getAttributeLocation("srcCoord" + ofToString(i));
+            if(location >= 0) {
+                faceVbo.disableAttribute(location);
+            }
+        }
+        
+        faceFbo.begin();
+        faceFbo.activateAllDrawBuffers();
+        clearRect(dirty);
+        faceShader.begin();
+        for(int i = 0; i < n; i++) {
+            faceShader.setUniformTexture("src" + ofToString(i), *srcs[first + i], 1 + i);
+        }
+        faceShader.setUniform1i("count", n);
+        faceVbo.drawElements(GL_TRIANGLES, camMesh.getNumIndices());
+        faceShader.end();
+        faceFbo.end();
+    }
+    // the mask and the blurred cam are shared by all the sources, source i
+    // ends up in clone.getTexture(i). camMesh can hold several faces, which
+    // are all drawn and cloned together, and srcPoints can have a face for
+    // each of them when they share a texture. up to Clone::maxSources
+    // sources are drawn and blurred in one pass, more than that are drawn
+    // Clone::maxSources at a time and blurred one by one.
+    void update(ofMesh& camMesh, ofBaseHasTexture& cam, vector<vector<ofVec2f>*>& srcPoints, vector<ofTexture*>& srcs) {
+        int total = srcs.size();
+        int vertices = camMesh.getNumVertices();
+        if(total == 0 || vertices == 0 || srcPoints.size() < total) {
+            return;
+        }
+        // a source without a face has nothing to map onto the mesh
+        for(int i = 0; i < total; i++) {
+            if(srcPoints[i]->empty()) {
+                return;
+            }
+        }
+        
         ofPushStyle();
         ofDisableDepthTest();
         
-        ofMesh camMesh = camTracker.getImageMesh();
-        camMesh.clearTexCoords();
-        camMesh.addTexCoords(srcPoints);
+        faceVbo.setVertexData(camMesh.getVerticesPointer(), vertices, GL_DYNAMIC_DRAW);
+        faceVbo.setIndexData(camMesh.getIndexPointer(), camMesh.getNumIndices(), GL_DYNAMIC_DRAW);
         
-        maskFbo.begin();
-        ofClear(0, 255);
-        camMesh.draw();
-        maskFbo.end();
-        
-        srcFbo.begin();
-        ofClear(0, 255);
-        src.bind();
-        camMesh.draw();
-        src.unbind();
-        srcFbo.end();
+        // only the face region is cleared and drawn, last frame's region is
+        // cleared too so nothing is left behind outside the new one
+        ofRectangle roi = getRoi(camMesh);
+        ofRectangle dirty = lastRoi.isEmpty() ? roi : lastRoi;
+        if(!roi.isEmpty()) {
+            dirty.growToInclude(roi);
+        }
+        lastRoi = roi;
         
-        clone.update(srcFbo.getTexture(), cam.getTexture(), maskFbo.getTexture());
+        if(total <= Clone::maxSources) {
+            drawSources(camMesh, srcPoints, srcs, 0, total, dirty);
+            vector<ofTexture*> srcTextures(total);
+            for(int i = 0; i < total; i++) {
+                srcTextures[i] = &getSrcTexture(i);
+            }
+            clone.update(srcTextures, cam.getTexture(), getMaskTexture(), roi);
+        } else {
+            // the mask is the same for every batch, so the cam is only
+            // blurred after the first one
+            for(int first = 0; first < total; first += Clone::maxSources) {
+                int n = MIN(total - first, (int) Clone::maxSources);
+                drawSources(camMesh, srcPoints, srcs, first, n, dirty);
+                if(first == 0) {
+                    clone.setDestination(cam.getTexture(), getMaskTexture(), roi);
+                }
+                for(int i = 0; i < n; i++) {
+                    clone.updateSource(getSrcTexture(i), first + i);
+                }
+            }
+        }
         ofPopStyle();
     }
 };
\ No newline at end of file
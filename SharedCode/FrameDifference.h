@@ -2,16 +2,246 @@
 
 #include "ofxCv.h"
 #include "ofMain.h"
+#include "FrameDifferenceKernels.h"
 
 class FrameDifference {
 private:
-    cv::Mat a, b, difference;
-    double meanVal, minVal, maxVal;
+    // preallocated ring of gray frames, newest at head. it is only
+    // reallocated when the frame size or the largest lag changes.
+    vector<cv::Mat> ring;
+    int head, stored;
+    
+    // frame lags to compare against, the first one also drives
+    // getDifference, the grid and the histogram
+    vector<int> lags;
+    vector<const cv::Mat*> lagFrames;
+    vector<FrameDifferenceKernels::Stats> lagStats;
+    vector<double> lagMean, lagMin, lagMax;
+    
+    cv::Mat difference, lagDifference;
+    int differenceLag;
+    bool useFusedKernel;
+    
+    // optional grid of per cell stats, row major, computed in the same pass
+    int gridCols, gridRows;
+    vector<int> gridX, gridY;
+    vector<FrameDifferenceKernels::Stats> gridStats;
+    vector<float> gridMean, gridMax;
+    vector<unsigned char> rowDifference;
+    
+    // optional 256 bin difference histogram with cumulative tables, so the
+    // robust stats below are constant time lookups
+    bool useHistogram;
+    vector<uint32_t> histogramParts, histogram;
+    vector<uint64_t> histogramCount, histogramSum;
+    
+    bool hasGrid() const {
+        return gridCols > 0 && gridRows > 0;
+    }
+    void resetGrid(int width, int height) {
+        int cols = MIN(gridCols, width), rows = MIN(gridRows, height);
+        gridX.resize(cols + 1);
+        gridY.resize(rows + 1);
+        for(int i = 0; i <= cols; i++) gridX[i] = (i * width) / cols;
+        for(int i = 0; i <= rows; i++) gridY[i] = (i * height) / rows;
+        gridStats.assign(cols * rows, FrameDifferenceKernels::Stats());
+        gridMean.resize(cols * rows);
+        gridMax.resize(cols * rows);
+    }
+    void accumulateGridRow(const unsigned char* diff, int cellRow) {
+        int cols = gridX.size() - 1;
+        FrameDifferenceKernels::Stats* cells = &gridStats[cellRow * cols];
+        for(int i = 0; i < cols; i++) {
+            FrameDifferenceKernels::reduceRow(diff + gridX[i], gridX[i + 1] - gridX[i], cells[i]);
+        }
+    }
+    void resetRowStats(int width, int height) {
+        rowDifference.resize(width);
+        if(hasGrid()) {
+            resetGrid(width, height);
+        }
+        if(useHistogram) {
+            histogramParts.assign(4 * 256, 0);
+        }
+    }
+    // grid and histogram both work from one row of the difference image
+    void accumulateRow(const unsigned char* diff, int width, int y, int& cellRow) {
+        if(hasGrid()) {
+            while(y >= gridY[cellRow + 1]) cellRow++;
+            accumulateGridRow(diff, cellRow);
+        }
+        if(useHistogram) {
+            FrameDifferenceKernels::histogramRow(diff, width, &histogramParts[0]);
+        }
+    }
+    void finishRowStats() {
+        if(hasGrid()) {
+            finishGrid();
+        }
+        if(useHistogram) {
+            finishHistogram();
+        }
+    }
+    void finishHistogram() {
+        histogram.resize(256);
+        histogramCount.resize(257);
+        histogramSum.resize(257);
+        histogramCount[0] = 0;
+        histogramSum[0] = 0;
+        for(int i = 0; i < 256; i++) {
+            histogram[i] = histogramParts[i] + histogramParts[i + 256] + histogramParts[i + 512] + histogramParts[i + 768];
+            histogramCount[i + 1] = histogramCount[i] + histogram[i];
+            histogramSum[i + 1] = histogramSum[i] + (uint64_t) histogram[i] * i;
+        }
+    }
+    // smallest difference value whose cumulative count reaches rank
+    int getHistogramBin(uint64_t rank) {
+        return upper_bound(histogramCount.begin() + 1, histogramCount.end(), rank - 1) - (histogramCount.begin() + 1);
+    }
+    // sum of the rank smallest difference values
+    uint64_t getHistogramRankSum(uint64_t rank) {
+        if(rank == 0) return 0;
+        int bin = getHistogramBin(rank);
+        return histogramSum[bin] + (rank - histogramCount[bin]) * bin;
+    }
+    int getCapacity() const {
+        return *max_element(lags.begin(), lags.end()) + 1;
+    }
+    void resetRing(int rows, int cols) {
+        ring.resize(getCapacity());
+        for(int i = 0; i < ring.size(); i++) {
+            ring[i].create(rows, cols, CV_8UC1);
+        }
+        head = 0;
+        stored = 0;
+    }
+    bool hasLag(int lag) const {
+        return stored > lag;
+    }
+    const cv::Mat& getLagged(int lag) const {
+        return ring[(head + ring.size() - lag) % ring.size()];
+    }
+    void setLagStats(int i, double mean, double min, double max) {
+        lagMean[i] = mean;
+        lagMin[i] = min;
+        lagMax[i] = max;
+    }
+    void finishGrid() {
+        int cols = gridX.size() - 1, rows = gridY.size() - 1;
+        for(int y = 0; y < rows; y++) {
+            for(int x = 0; x < cols; x++) {
+                int i = y * cols + x;
+                double count = (gridX[x + 1] - gridX[x]) * (gridY[y + 1] - gridY[y]);
+                gridMean[i] = (gridStats[i].sum * (1. / count)) / 255.;
+                gridMax[i] = gridStats[i].max / 255.;
+            }
+        }
+    }
+
+    // the original multi pass path, still used for anything that isn't 8 bit
+    // gray, rgb or rgba
+    void updateOpenCv(cv::Mat& frame, cv::Mat& cur) {
+        ofxCv::copyGray(frame, cur);
+        for(int i = 0; i < lags.size(); i++) {
+            if(!hasLag(lags[i])) continue;
+            cv::Mat& diff = i == 0 ? difference : lagDifference;
+            absdiff(cur, getLagged(lags[i]), diff);
+            double minVal, maxVal;
+            cv::minMaxIdx(diff, &minVal, &maxVal);
+            setLagStats(i, cv::mean(diff)[0] / 255., minVal / 255, maxVal / 255);
+            if(i == 0) {
+                differenceLag = 0;
+                if(hasGrid() || useHistogram) {
+                    resetRowStats(diff.cols, diff.rows);
+                    int cellRow = 0;
+                    for(int y = 0; y < diff.rows; y++) {
+                        accumulateRow(diff.ptr<uchar>(y), diff.cols, y, cellRow);
+                    }
+                    finishRowStats();
+                }
+            }
+        }
+    }
+
+    // gray conversion, differences against every lag and their stats in one
+    // pass over the frame. the first lag is fused with the gray conversion,
+    // the others reuse the fresh gray row while it is still in cache. the
+    // difference image is only written when someone asks for it.
+    void updateFused(cv::Mat& frame, cv::Mat& cur) {
+        int channels = frame.channels(), width = frame.cols;
+        for(int i = 0; i < lags.size(); i++) {
+            lagFrames[i] = hasLag(lags[i]) ? &getLagged(lags[i]) : NULL;
+        }
+        lagStats.assign(lags.size(), FrameDifferenceKernels::Stats());
+        const cv::Mat* primary = lagFrames[0];
+        bool rowStats = primary && (hasGrid() || useHistogram);
+        if(rowStats) {
+            resetRowStats(width, frame.rows);
+        }
+        unsigned char* diff = rowStats ? &rowDifference[0] : NULL;
+        int cellRow = 0;
+        for(int y = 0; y < frame.rows; y++) {
+            const unsigned char* src = frame.ptr<uchar>(y);
+            unsigned char* gray = cur.ptr<uchar>(y);
+            if(primary) {
+                FrameDifferenceKernels::grayDiffRow(src, channels, primary->ptr<uchar>(y), gray, diff, width, lagStats[0]);
+                if(rowStats) {
+                    accumulateRow(diff, width, y, cellRow);
+                }
+            } else {
+                FrameDifferenceKernels::grayRow(src, channels, gray, width);
+            }
+            for(int i = 1; i < lags.size(); i++) {
+                if(lagFrames[i]) {
+                    FrameDifferenceKernels::diffRow(gray, lagFrames[i]->ptr<uchar>(y), width, lagStats[i]);
+                }
+            }
+        }
+        if(rowStats) {
+            finishRowStats();
+        }
+        // same arithmetic as cv::mean, which scales the sum by 1 / count
+        double count = frame.total();
+        for(int i = 0; i < lags.size(); i++) {
+            if(lagFrames[i]) {
+                const FrameDifferenceKernels::Stats& stats = lagStats[i];
+                setLagStats(i, (stats.sum * (1. / count)) / 255., stats.min / 255., stats.max / 255.);
+            }
+        }
+    }
+
 public:
     FrameDifference()
-    :meanVal(0)
-    ,minVal(0)
-    ,maxVal(0) {
+    :head(0)
+    ,stored(0)
+    ,differenceLag(-1)
+    ,useFusedKernel(true)
+    ,gridCols(0)
+    ,gridRows(0)
+    ,useHistogram(false) {
+        setLags(vector<int>(1, 1));
+    }
+    // compare against several earlier frames at once, e.g. {1, 4, 15}
+    void setLags(const vector<int>& lags) {
+        this->lags.clear();
+        for(int i = 0; i < lags.size(); i++) {
+            this->lags.push_back(MAX(lags[i], 1));
+        }
+        if(this->lags.empty()) {
+            this->lags.push_back(1);
+        }
+        lagFrames.assign(this->lags.size(), NULL);
+        lagMean.assign(this->lags.size(), 0);
+        lagMin.assign(this->lags.size(), 0);
+        lagMax.assign(this->lags.size(), 0);
+        differenceLag = -1;
+    }
+    const vector<int>& getLags() {
+        return lags;
+    }
+    // switch back to the OpenCV path, e.g. to compare against the kernel
+    void setUseFusedKernel(bool useFusedKernel) {
+        this->useFusedKernel = useFusedKernel;
     }
     template <class F>
     void update(F& frame) {
@@ -19,23 +249,108 @@ public:
         update(frameMat);
     }
     void update(cv::Mat& frame) {
-        ofxCv::copyGray(frame, a);
-        if(a.size() == b.size()) {
-            absdiff(a, b, difference);
-            meanVal = cv::mean(difference)[0] / 255.;
-            cv::minMaxIdx(difference, &minVal, &maxVal);
-            minVal /= 255;
-            maxVal /= 255;
+        if(ring.size() != getCapacity() || ring[0].rows != frame.rows || ring[0].cols != frame.cols) {
+            resetRing(frame.rows, frame.cols);
         }
-        swap(a, b);
+        head = (head + 1) % ring.size();
+        stored = MIN(stored + 1, (int) ring.size());
+        differenceLag = -1;
+        int channels = frame.channels();
+        if(useFusedKernel && frame.depth() == CV_8U && (channels == 1 || channels == 3 || channels == 4)) {
+            updateFused(frame, ring[head]);
+        } else {
+            updateOpenCv(frame, ring[head]);
+        }
+    }
+    // false for an index past the lags, or a lag that doesn't have enough
+    // frames behind it yet
+    bool isLagReady(int lagIndex = 0) const {
+        return lagIndex >= 0 && lagIndex < lags.size() && hasLag(lags[lagIndex]);
     }
-    cv::Mat& getDifference() {
+    // a black image when the lag isn't ready
+    cv::Mat& getDifference(int lagIndex = 0) {
+        if(!isLagReady(lagIndex)) {
+            if(ring.empty()) {
+                difference.release();
+            } else {
+                difference = cv::Mat::zeros(ring[0].rows, ring[0].cols, CV_8UC1);
+            }
+            differenceLag = -1;
+        } else if(differenceLag != lagIndex) {
+            absdiff(ring[head], getLagged(lags[lagIndex]), difference);
+            differenceLag = lagIndex;
+        }
         return difference;
     }
-    float getMean() {
-        return meanVal;
+    // 0 when the lag isn't ready
+    float getMean(int lagIndex = 0) {
+        return isLagReady(lagIndex) ? lagMean[lagIndex] : 0;
+    }
+    float getMax(int lagIndex = 0) {
+        return isLagReady(lagIndex) ? lagMax[lagIndex] : 0;
+    }
+    // split the frame into cols x rows cells, 0 turns the grid off
+    void setGrid(int cols, int rows) {
+        gridCols = MAX(cols, 0);
+        gridRows = MAX(rows, 0);
+        if(!hasGrid()) {
+            gridMean.clear();
+            gridMax.clear();
+        }
+    }
+    // true once the last update() had a frame to compare against, so the
+    // cells hold stats of this frame
+    bool isGridReady() const {
+        return hasGrid() && isLagReady(0) && !gridX.empty() && !gridY.empty();
+    }
+    int getGridCols() {
+        return hasGrid() && !gridX.empty() ? gridX.size() - 1 : 0;
+    }
+    int getGridRows() {
+        return hasGrid() && !gridY.empty() ? gridY.size() - 1 : 0;
+    }
+    // per cell mean and max, row major and normalized like getMean/getMax
+    const vector<float>& getGridMean() {
+        return gridMean;
+    }
+    const vector<float>& getGridMax() {
+        return gridMax;
+    }
+    void setUseHistogram(bool useHistogram) {
+        this->useHistogram = useHistogram;
+        if(!useHistogram) {
+            histogram.clear();
+        }
+    }
+    bool hasHistogram() {
+        return useHistogram && !histogram.empty() && histogramCount.back() > 0;
+    }
+    // 256 bins of raw difference values
+    const vector<uint32_t>& getHistogram() {
+        return histogram;
+    }
+    // difference value below which a fraction p of the pixels fall, 0 to 1
+    float getPercentile(float p) {
+        if(!hasHistogram()) return 0;
+        uint64_t total = histogramCount.back();
+        uint64_t rank = ofClamp(ceil(p * total), 1, total);
+        return getHistogramBin(rank) / 255.;
+    }
+    // number of pixels whose difference is above threshold, 0 to 1
+    uint64_t getCountAbove(float threshold) {
+        if(!hasHistogram()) return 0;
+        int bin = ofClamp(floor(threshold * 255), -1, 255);
+        return histogramCount.back() - histogramCount[bin + 1];
     }
-    float getMax() {
-        return maxVal;
+    // mean of the pixels between the lower and upper fractions, e.g. .5 to 1
+    // ignores the static half of the frame
+    float getTrimmedMean(float lower, float upper) {
+        if(!hasHistogram()) return 0;
+        uint64_t total = histogramCount.back();
+        uint64_t lowerRank = ofClamp(floor(lower * total), 0, total);
+        uint64_t upperRank = ofClamp(ceil(upper * total), 0, total);
+        if(upperRank <= lowerRank) return getPercentile(lower);
+        uint64_t sum = getHistogramRankSum(upperRank) - getHistogramRankSum(lowerRank);
+        return (sum / (double) (upperRank - lowerRank)) / 255.;
     }
 };
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// row kernels for FrameDifference. the gray conversion uses the same 14 bit
+// fixed point weights and rounding as OpenCV's CV_RGB2GRAY, so one fused pass
+// matches copyGray + absdiff + mean + minMaxIdx bit for bit.
+
+namespace FrameDifferenceKernels {
+
+    enum {
+        grayShift = 14,
+        grayRound = 1 << (grayShift - 1),
+        grayR = 4899,
+        grayG = 9617,
+        grayB = 1868
+    };
+
+    struct Stats {
+        uint64_t sum;
+        unsigned char min, max;
+        Stats()
+        :sum(0)
+        ,min(255)
+        ,max(0) {
+        }
+    };
+
+    inline unsigned char toGray(const unsigned char* p) {
+        return (unsigned char) ((p[0] * grayR + p[1] * grayG + p[2] * grayB + grayRound) >> grayShift);
+    }
+
+    template <int channels>
+    inline void grayDiffScalar(const unsigned char* src, const unsigned char* prev, unsigned char* gray, unsigned char* diff, int n, Stats& stats) {
+        uint64_t sum = 0;
+        unsigned char lo = stats.min, hi = stats.max;
+        for(int i = 0; i < n; i++, src += channels) {
+            unsigned char cur = channels == 1 ? src[0] : toGray(src);
+            unsigned char d = cur > prev[i] ? cur - prev[i] : prev[i] - cur;
+            gray[i] = cur;
+            if(diff) diff[i] = d;
+            sum += d;
+            if(d < lo) lo = d;
+            if(d > hi) hi = d;
+        }
+        stats.sum += sum;
+        stats.min = lo;
+        stats.max = hi;
+    }
+
+    // gray conversion only, for the first frame when there is nothing to diff
+    inline void grayRow(const unsigned char* src, int channels, unsigned char* gray, int n) {
+        if(channels == 1) {
+            for(int i = 0; i < n; i++) gray[i] = src[i];
+        } else {
+            for(int i = 0; i < n; i++, src += channels) gray[i] = toGray(src);
+        }
+    }
+
+#if defined(__SSSE3__)
+    // 8 pixels of 16 bit r, g, b to 16 bit gray using two madds per half
+    inline __m128i grayWords(__m128i r, __m128i g, __m128i b) {
+        const __m128i rg = _mm_setr_epi16(grayR, grayG, grayR, grayG, grayR, grayG, grayR, grayG);
+        const __m128i bRound = _mm_setr_epi16(grayB, grayRound, grayB, grayRound, grayB, grayRound, grayB, grayRound);
+        const __m128i one = _mm_set1_epi16(1);
+        __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), rg),
+                                   _mm_madd_epi16(_mm_unpacklo_epi16(b, one), bRound));
+        __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), rg),
+                                   _mm_madd_epi16(_mm_unpackhi_epi16(b, one), bRound));
+        return _mm_packs_epi32(_mm_srli_epi32(lo, grayShift), _mm_srli_epi32(hi, grayShift));
+    }
+
+    // 16 interleaved rgb pixels (48 bytes) to 16 gray bytes
+    inline __m128i grayRgb16(const unsigned char* src) {
+        const __m128i v0 = _mm_loadu_si128((const __m128i*) src);
+        const __m128i v1 = _mm_loadu_si128((const __m128i*) (src + 16));
+        const __m128i v2 = _mm_loadu_si128((const __m128i*) (src + 32));
+        __m128i r = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(v0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+        __m128i g = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(v0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+        __m128i b = _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(v0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            _mm_shuffle_epi8(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+            _mm_shuffle_epi8(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lo = grayWords(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i hi = grayWords(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero));
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    inline __m128i absDiff(__m128i a, __m128i b) {
+        return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    }
+
+    inline void reduce(__m128i sum, __m128i lo, __m128i hi, Stats& stats) {
+        uint64_t sums[2];
+        unsigned char los[16], his[16];
+        _mm_storeu_si128((__m128i*) sums, sum);
+        _mm_storeu_si128((__m128i*) los, lo);
+        _mm_storeu_si128((__m128i*) his, hi);
+        stats.sum += sums[0] + sums[1];
+        for(int i = 0; i < 16; i++) {
+            if(los[i] < stats.min) stats.min = los[i];
+            if(his[i] > stats.max) stats.max = his[i];
+        }
+    }
+#endif
+
+#if defined(__AVX2__)
+    inline __m256i grayWords(__m256i r, __m256i g, __m256i b) {
+        const __m256i rg = _mm256_broadcastsi128_si256(_mm_setr_epi16(grayR, grayG, grayR, grayG, grayR, grayG, grayR, grayG));
+        const __m256i bRound = _mm256_broadcastsi128_si256(_mm_setr_epi16(grayB, grayRound, grayB, grayRound, grayB, grayRound, grayB, grayRound));
+        const __m256i one = _mm256_set1_epi16(1);
+        __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), rg),
+                                      _mm256_madd_epi16(_mm256_unpacklo_epi16(b, one), bRound));
+        __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), rg),
+                                      _mm256_madd_epi16(_mm256_unpackhi_epi16(b, one), bRound));
+        return _mm256_packs_epi32(_mm256_srli_epi32(lo, grayShift), _mm256_srli_epi32(hi, grayShift));
+    }
+
+    // loads pixels 0-15 into the low lane and 16-31 into the high lane. every
+    // shuffle, unpack and pack below stays inside its lane, so the lanes come
+    // back out in pixel order.
+    inline __m256i loadLanes(const unsigned char* src) {
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) src)),
+                                       _mm_loadu_si128((const __m128i*) (src + 48)), 1);
+    }
+
+    inline __m256i shuffleLanes(__m256i v, __m128i mask) {
+        return _mm256_shuffle_epi8(v, _mm256_broadcastsi128_si256(mask));
+    }
+
+    // 32 interleaved rgb pixels (96 bytes) to 32 gray bytes
+    inline __m256i grayRgb32(const unsigned char* src) {
+        const __m256i v0 = loadLanes(src);
+        const __m256i v1 = loadLanes(src + 16);
+        const __m256i v2 = loadLanes(src + 32);
+        __m256i r = _mm256_or_si256(_mm256_or_si256(
+            shuffleLanes(v0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            shuffleLanes(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+            shuffleLanes(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+        __m256i g = _mm256_or_si256(_mm256_or_si256(
+            shuffleLanes(v0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            shuffleLanes(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+            shuffleLanes(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+        __m256i b = _mm256_or_si256(_mm256_or_si256(
+            shuffleLanes(v0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+            shuffleLanes(v1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+            shuffleLanes(v2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i lo = grayWords(_mm256_unpacklo_epi8(r, zero), _mm256_unpacklo_epi8(g, zero), _mm256_unpacklo_epi8(b, zero));
+        __m256i hi = grayWords(_mm256_unpackhi_epi8(r, zero), _mm256_unpackhi_epi8(g, zero), _mm256_unpackhi_epi8(b, zero));
+        return _mm256_packus_epi16(lo, hi);
+    }
+
+    inline __m256i absDiff(__m256i a, __m256i b) {
+        return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+    }
+
+    inline void reduce(__m256i sum, __m256i lo, __m256i hi, Stats& stats) {
+        reduce(_mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)),
+               _mm_min_epu8(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1)),
+               _mm_max_epu8(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1)),
+               stats);
+    }
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    inline uint8x8_t grayHalf(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+        uint16x8_t r16 = vmovl_u8(r), g16 = vmovl_u8(g), b16 = vmovl_u8(b);
+        uint32x4_t lo = vmull_n_u16(vget_low_u16(r16), grayR);
+        lo = vmlal_n_u16(lo, vget_low_u16(g16), grayG);
+        lo = vmlal_n_u16(lo, vget_low_u16(b16), grayB);
+        uint32x4_t hi = vmull_n_u16(vget_high_u16(r16), grayR);
+        hi = vmlal_n_u16(hi, vget_high_u16(g16), grayG);
+        hi = vmlal_n_u16(hi, vget_high_u16(b16), grayB);
+        // vrshrn adds the same half-unit rounding before shifting
+        return vmovn_u16(vcombine_u16(vrshrn_n_u32(lo, grayShift), vrshrn_n_u32(hi, grayShift)));
+    }
+
+    inline uint8x16_t grayRgb16(const unsigned char* src) {
+        uint8x16x3_t rgb = vld3q_u8(src);
+        return vcombine_u8(grayHalf(vget_low_u8(rgb.val[0]), vget_low_u8(rgb.val[1]), vget_low_u8(rgb.val[2])),
+                           grayHalf(vget_high_u8(rgb.val[0]), vget_high_u8(rgb.val[1]), vget_high_u8(rgb.val[2])));
+    }
+
+    inline void reduce(uint32x4_t sum, uint8x16_t lo, uint8x16_t hi, Stats& stats) {
+        uint64x2_t sum64 = vpaddlq_u32(sum);
+        unsigned char los[16], his[16];
+        vst1q_u8(los, lo);
+        vst1q_u8(his, hi);
+        stats.sum += vgetq_lane_u64(sum64, 0) + vgetq_lane_u64(sum64, 1);
+        for(int i = 0; i < 16; i++) {
+            if(los[i] < stats.min) stats.min = los[i];
+            if(his[i] > stats.max) stats.max = his[i];
+        }
+    }
+#endif
+
+    // converts one row to gray into gray[], diffs it against prev[] and
+    // accumulates sum, min and max into stats. diff[] is optional.
+    inline void grayDiffRow(const unsigned char* src, int channels, const unsigned char* prev, unsigned char* gray, unsigned char* diff, int n, Stats& stats) {
+        int i = 0;
+        if(channels == 3 || channels == 1) {
+#if defined(__AVX2__)
+            {
+                __m256i sum = _mm256_setzero_si256(), lo = _mm256_set1_epi8(-1), hi = _mm256_setzero_si256();
+                for(; i + 32 <= n; i += 32) {
+                    __m256i cur = channels == 3 ? grayRgb32(src + i * 3) : _mm256_loadu_si256((const __m256i*) (src + i));
+                    __m256i d = absDiff(cur, _mm256_loadu_si256((const __m256i*) (prev + i)));
+                    _mm256_storeu_si256((__m256i*) (gray + i), cur);
+                    if(diff) _mm256_storeu_si256((__m256i*) (diff + i), d);
+                    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(d, _mm256_setzero_si256()));
+                    lo = _mm256_min_epu8(lo, d);
+                    hi = _mm256_max_epu8(hi, d);
+                }
+                reduce(sum, lo, hi, stats);
+            }
+#endif
+#if defined(__SSSE3__)
+            {
+                __m128i sum = _mm_setzero_si128(), lo = _mm_set1_epi8(-1), hi = _mm_setzero_si128();
+                for(; i + 16 <= n; i += 16) {
+                    __m128i cur = channels == 3 ? grayRgb16(src + i * 3) : _mm_loadu_si128((const __m128i*) (src + i));
+                    __m128i d = absDiff(cur, _mm_loadu_si128((const __m128i*) (prev + i)));
+                    _mm_storeu_si128((__m128i*) (gray + i), cur);
+                    if(diff) _mm_storeu_si128((__m128i*) (diff + i), d);
+                    sum = _mm_add_epi64(sum, _mm_sad_epu8(d, _mm_setzero_si128()));
+                    lo = _mm_min_epu8(lo, d);
+                    hi = _mm_max_epu8(hi, d);
+                }
+                reduce(sum, lo, hi, stats);
+            }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+            {
+                uint32x4_t sum = vdupq_n_u32(0);
+                uint8x16_t lo = vdupq_n_u8(255), hi = vdupq_n_u8(0);
+                for(; i + 16 <= n; i += 16) {
+                    uint8x16_t cur = channels == 3 ? grayRgb16(src + i * 3) : vld1q_u8(src + i);
+                    uint8x16_t d = vabdq_u8(cur, vld1q_u8(prev + i));
+                    vst1q_u8(gray + i, cur);
+                    if(diff) vst1q_u8(diff + i, d);
+                    sum = vpadalq_u16(sum, vpaddlq_u8(d));
+                    lo = vminq_u8(lo, d);
+                    hi = vmaxq_u8(hi, d);
+                }
+                reduce(sum, lo, hi, stats);
+            }
+#endif
+        }
+        if(i < n) {
+            const unsigned char* rest = src + i * channels;
+            unsigned char* restDiff = diff ? diff + i : NULL;
+            switch(channels) {
+                case 1: grayDiffScalar<1>(rest, prev + i, gray + i, restDiff, n - i, stats); break;
+                case 3: grayDiffScalar<3>(rest, prev + i, gray + i, restDiff, n - i, stats); break;
+                case 4: grayDiffScalar<4>(rest, prev + i, gray + i, restDiff, n - i, stats); break;
+            }
+        }
+    }
+
+    // accumulates sum, min and max of an already computed difference segment.
+    // used for the grid cells, which can be only a few pixels wide.
+    inline void reduceRow(const unsigned char* diff, int n, Stats& stats) {
+        int i = 0;
+#if defined(__AVX2__)
+        if(n >= 32) {
+            __m256i sum = _mm256_setzero_si256(), lo = _mm256_set1_epi8(-1), hi = _mm256_setzero_si256();
+            for(; i + 32 <= n; i += 32) {
+                __m256i d = _mm256_loadu_si256((const __m256i*) (diff + i));
+                sum = _mm256_add_epi64(sum, _mm256_sad_epu8(d, _mm256_setzero_si256()));
+                lo = _mm256_min_epu8(lo, d);
+                hi = _mm256_max_epu8(hi, d);
+            }
+            reduce(sum, lo, hi, stats);
+        }
+#endif
+#if defined(__SSSE3__)
+        if(n - i >= 16) {
+            __m128i sum = _mm_setzero_si128(), lo = _mm_set1_epi8(-1), hi = _mm_setzero_si128();
+            for(; i + 16 <= n; i += 16) {
+                __m128i d = _mm_loadu_si128((const __m128i*) (diff + i));
+                sum = _mm_add_epi64(sum, _mm_sad_epu8(d, _mm_setzero_si128()));
+                lo = _mm_min_epu8(lo, d);
+                hi = _mm_max_epu8(hi, d);
+            }
+            reduce(sum, lo, hi, stats);
+        }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        if(n >= 16) {
+            uint32x4_t sum = vdupq_n_u32(0);
+            uint8x16_t lo = vdupq_n_u8(255), hi = vdupq_n_u8(0);
+            for(; i + 16 <= n; i += 16) {
+                uint8x16_t d = vld1q_u8(diff + i);
+                sum = vpadalq_u16(sum, vpaddlq_u8(d));
+                lo = vminq_u8(lo, d);
+                hi = vmaxq_u8(hi, d);
+            }
+            reduce(sum, lo, hi, stats);
+        }
+#endif
+        uint64_t sum = 0;
+        unsigned char lo = stats.min, hi = stats.max;
+        for(; i < n; i++) {
+            unsigned char d = diff[i];
+            sum += d;
+            if(d < lo) lo = d;
+            if(d > hi) hi = d;
+        }
+        stats.sum += sum;
+        stats.min = lo;
+        stats.max = hi;
+    }
+
+    // adds a difference segment to four interleaved 256 bin histograms, so
+    // runs of equal values don't serialize on the same counter
+    inline void histogramRow(const unsigned char* diff, int n, uint32_t* histograms) {
+        uint32_t* h0 = histograms;
+        uint32_t* h1 = histograms + 256;
+        uint32_t* h2 = histograms + 512;
+        uint32_t* h3 = histograms + 768;
+        int i = 0;
+        for(; i + 4 <= n; i += 4) {
+            h0[diff[i]]++;
+            h1[diff[i + 1]]++;
+            h2[diff[i + 2]]++;
+            h3[diff[i + 3]]++;
+        }
+        for(; i < n; i++) {
+            h0[diff[i]]++;
+        }
+    }
+
+    // diffs two gray rows and accumulates sum, min and max, used for the lags
+    // after the first one while the current row is still in cache
+    inline void diffRow(const unsigned char* cur, const unsigned char* prev, int n, Stats& stats) {
+        int i = 0;
+#if defined(__AVX2__)
+        if(n >= 32) {
+            __m256i sum = _mm256_setzero_si256(), lo = _mm256_set1_epi8(-1), hi = _mm256_setzero_si256();
+            for(; i + 32 <= n; i += 32) {
+                __m256i d = absDiff(_mm256_loadu_si256((const __m256i*) (cur + i)), _mm256_loadu_si256((const __m256i*) (prev + i)));
+                sum = _mm256_add_epi64(sum, _mm256_sad_epu8(d, _mm256_setzero_si256()));
+                lo = _mm256_min_epu8(lo, d);
+                hi = _mm256_max_epu8(hi, d);
+            }
+            reduce(sum, lo, hi, stats);
+        }
+#endif
+#if defined(__SSSE3__)
+        if(n - i >= 16) {
+            __m128i sum = _mm_setzero_si128(), lo = _mm_set1_epi8(-1), hi = _mm_setzero_si128();
+            for(; i + 16 <= n; i += 16) {
+                __m128i d = absDiff(_mm_loadu_si128((const __m128i*) (cur + i)), _mm_loadu_si128((const __m128i*) (prev + i)));
+                sum = _mm_add_epi64(sum, _mm_sad_epu8(d, _mm_setzero_si128()));
+                lo = _mm_min_epu8(lo, d);
+                hi = _mm_max_epu8(hi, d);
+            }
+            reduce(sum, lo, hi, stats);
+        }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        if(n >= 16) {
+            uint32x4_t sum = vdupq_n_u32(0);
+            uint8x16_t lo = vdupq_n_u8(255), hi = vdupq_n_u8(0);
+            for(; i + 16 <= n; i += 16) {
+                uint8x16_t d = vabdq_u8(vld1q_u8(cur + i), vld1q_u8(prev + i));
+                sum = vpadalq_u16(sum, vpaddlq_u8(d));
+                lo = vminq_u8(lo, d);
+                hi = vmaxq_u8(hi, d);
+            }
+            reduce(sum, lo, hi, stats);
+        }
+#endif
+        uint64_t sum = 0;
+        unsigned char lo = stats.min, hi = stats.max;
+        for(; i < n; i++) {
+            unsigned char d = cur[i] > prev[i] ? cur[i] - prev[i] : prev[i] - cur[i];
+            sum += d;
+            if(d < lo) lo = d;
+            if(d > hi) hi = d;
+        }
+        stats.sum += sum;
+        stats.min = lo;
+        stats.max = hi;
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "ofMain.h"
+
+// the last few frames, kept on the gpu. push() draws the new frame into the
+// oldest fbo and moves the ring index, so nothing is copied on the cpu and
+// older frames are never moved. pixels are only read back when asked for,
+// once per frame.
+class FrameHistory {
+protected:
+    vector<ofFbo> frames;
+    vector<ofPixels> pixels;
+    vector<bool> pixelsDirty;
+    int newest, count;
+    
+    int getIndex(int age) const {
+        return (newest - age + frames.size()) % frames.size();
+    }
+    
+public:
+    FrameHistory()
+    :newest(0)
+    ,count(0) {
+    }
+    
+    void setup(int width, int height, int length = 2, int internalFormat = GL_RGB) {
+        frames.resize(length);
+        pixels.resize(length);
+        pixelsDirty.assign(length, true);
+        for(int i = 0; i < length; i++) {
+            frames[i].allocate(width, height, internalFormat);
+        }
+        newest = 0;
+        count = 0;
+    }
+    
+    void push(ofBaseHasTexture& img) {
+        push(img.getTexture());
+    }
+    
+    void push(ofTexture& tex) {
+        newest = (newest + 1) % frames.size();
+        count = MIN(count + 1, (int) frames.size());
+        ofFbo& frame = frames[newest];
+        frame.begin();
+        ofPushStyle();
+        ofDisableAlphaBlending();
+        tex.draw(0, 0, frame.getWidth(), frame.getHeight());
+        ofPopStyle();
+        frame.end();
+        pixelsDirty[newest] = true;
+    }
+    
+    // how many frames have been pushed, up to the length of the history
+    int size() const {
+        return count;
+    }
+    
+    // age 0 is the newest frame
+    ofFbo& get(int age = 0) {
+        return frames[getIndex(age)];
+    }
+    
+    ofTexture& getTexture(int age = 0) {
+        return get(age).getTexture();
+    }
+    
+    ofPixels& getPixels(int age = 0) {
+        int i = getIndex(age);
+        if(pixelsDirty[i]) {
+            frames[i].readToPixels(pixels[i]);
+            pixelsDirty[i] = false;
+        }
+        return pixels[i];
+    }
+};
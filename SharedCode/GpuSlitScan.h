@@ -0,0 +1,227 @@
+#pragma once
+
+#include "ofMain.h"
+
+// a delay line like ofxSlitScan that never leaves the gpu. the last
+// capacity frames live in a texture array used as a ring, new frames are
+// copied in from an fbo and the delayed (or slit scanned) output is drawn
+// by a shader, so there's no readback and no upload per frame.
+class GpuSlitScan {
+public:
+    // YUV420 keeps full resolution luma and half resolution chroma, half
+    // the memory and copy bandwidth of RGB. it's converted back to RGB when
+    // the output is drawn.
+    enum Storage {RGB, YUV420};
+    
+protected:
+    int width, height, capacity;
+    Storage storage;
+    GLuint frames, chroma;
+    ofFbo scratch, scratchChroma, output;
+    ofShader shader, yuvShader;
+    int newest, count;
+    float timeDelay, timeWidth;
+    bool blending;
+    ofTexture* delayMap;
+    
+    // 0 when there isn't enough video memory for capacity layers
+    GLuint allocateFrames(int w, int h, GLint internalFormat, GLenum format) {
+        while(glGetError() != GL_NO_ERROR);
+        GLuint id;
+        glGenTextures(1, &id);
+        glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, id);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, internalFormat, w, h, capacity, 0, format, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, 0);
+        if(glGetError() == GL_OUT_OF_MEMORY) {
+            glDeleteTextures(1, &id);
+            return 0;
+        }
+        return id;
+    }
+    
+    void releaseFrames() {
+        if(frames) {
+            glDeleteTextures(1, &frames);
+            frames = 0;
+        }
+        if(chroma) {
+            glDeleteTextures(1, &chroma);
+            chroma = 0;
+        }
+    }
+    
+    // draws tex into fbo, through shader if it's given, and copies the
+    // result into the newest layer of target
+    void copyFrame(ofTexture& tex, ofFbo& fbo, GLuint target, ofShader* shader) {
+        int w = fbo.getWidth(), h = fbo.getHeight();
+        // the copy reads from the bound fbo, so it has to happen before end()
+        fbo.begin();
+        ofPushStyle();
+        ofDisableAlphaBlending();
+        if(shader != NULL) {
+            shader->begin();
+            shader->setUniformTexture("tex", tex, 1);
+            shader->setUniform1i("chroma", &fbo == &scratchChroma);
+        }
+        tex.draw(0, 0, w, h);
+        if(shader != NULL) {
+            shader->end();
+        }
+        ofPopStyle();
+        glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, target);
+        glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY_EXT, 0, 0, 0, newest, 0, 0, w, h);
+        glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, 0);
+        fbo.end();
+    }
+    
+    void updateOutput() {
+        if(count == 0) {
+            return;
+        }
+        output.begin();
+        ofPushStyle();
+        ofDisableAlphaBlending();
+        shader.begin();
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, frames);
+        shader.setUniform1i("frames", 1);
+        if(storage == YUV420) {
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, chroma);
+            shader.setUniform1i("chroma", 3);
+        }
+        shader.setUniform1i("yuv", storage == YUV420);
+        if(delayMap != NULL) {
+            shader.setUniformTexture("delayMap", *delayMap, 2);
+        }
+        shader.setUniform1i("useDelayMap", delayMap != NULL);
+        shader.setUniform2f("size", width, height);
+        shader.setUniform1f("newest", newest);
+        shader.setUniform1f("count", count);
+        shader.setUniform1f("capacity", capacity);
+        shader.setUniform1f("timeDelay", timeDelay);
+        shader.setUniform1f("timeWidth", timeWidth);
+        shader.setUniform1i("blending", blending);
+        scratch.draw(0, 0);
+        shader.end();
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, 0);
+        glActiveTexture(GL_TEXTURE0);
+        ofPopStyle();
+        output.end();
+    }
+
+public:
+    GpuSlitScan()
+    :width(0)
+    ,height(0)
+    ,capacity(0)
+    ,storage(RGB)
+    ,frames(0)
+    ,chroma(0)
+    ,newest(0)
+    ,count(0)
+    ,timeDelay(0)
+    ,timeWidth(0)
+    ,blending(false)
+    ,delayMap(NULL) {
+    }
+    
+    ~GpuSlitScan() {
+        releaseFrames();
+    }
+    
+    // capacity is clamped to the most layers a texture array can have, which
+    // is 256 on many drivers. false when the frames don't fit in video
+    // memory, nothing is delayed then.
+    bool setup(int width, int height, int capacity, Storage storage = RGB) {
+        this->width = width;
+        this->height = height;
+        this->storage = storage;
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS_EXT, &maxLayers);
+        if(maxLayers > 0 && capacity > maxLayers) {
+            ofLogWarning("GpuSlitScan") << "asked for " << capacity << " frames, a texture array only holds " << maxLayers;
+            capacity = maxLayers;
+        }
+        this->capacity = capacity;
+        releaseFrames();
+        
+        if(storage == YUV420) {
+            int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+            frames = allocateFrames(width, height, GL_R8, GL_RED);
+            chroma = allocateFrames(chromaWidth, chromaHeight, GL_RG8, GL_RG);
+            scratch.allocate(width, height, GL_R8);
+            scratchChroma.allocate(chromaWidth, chromaHeight, GL_RG8);
+            yuvShader.load("shaders/Flow.vert", "shaders/GpuSlitScanYuv.frag");
+        } else {
+            frames = allocateFrames(width, height, GL_RGB8, GL_RGB);
+            scratch.allocate(width, height, GL_RGB);
+        }
+        output.allocate(width, height, GL_RGB);
+        shader.load("shaders/Flow.vert", "shaders/GpuSlitScan.frag");
+        newest = 0;
+        count = 0;
+        
+        if(!frames || (storage == YUV420 && !chroma)) {
+            ofLogError("GpuSlitScan") << "not enough video memory for " << capacity << " frames";
+            releaseFrames();
+            this->capacity = 0;
+            return false;
+        }
+        return true;
+    }
+    
+    void setBlending(bool blending) {
+        this->blending = blending;
+    }
+    
+    // same as ofxSlitScan: each pixel is delayed by timeDelay plus its delay
+    // map value times timeWidth, in frames. without a delay map the whole
+    // frame has the same delay.
+    void setTimeDelayAndWidth(float timeDelay, float timeWidth) {
+        this->timeDelay = timeDelay;
+        this->timeWidth = timeWidth;
+        updateOutput();
+    }
+    
+    void setDelayMap(ofTexture& delayMap) {
+        this->delayMap = &delayMap;
+    }
+    
+    int getCapacity() const {
+        return capacity;
+    }
+    
+    void addImage(ofBaseHasTexture& img) {
+        addImage(img.getTexture());
+    }
+    
+    void addImage(ofTexture& tex) {
+        if(capacity == 0) {
+            return;
+        }
+        newest = (newest + 1) % capacity;
+        count = MIN(count + 1, capacity);
+        
+        if(storage == YUV420) {
+            copyFrame(tex, scratch, frames, &yuvShader);
+            copyFrame(tex, scratchChroma, chroma, &yuvShader);
+        } else {
+            copyFrame(tex, scratch, frames, NULL);
+        }
+        
+        updateOutput();
+    }
+    
+    // named like ofxSlitScan so getOutputImage().getTexture() works with either
+    ofFbo& getOutputImage() {
+        return output;
+    }
+};
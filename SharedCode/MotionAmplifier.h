@@ -3,25 +3,98 @@
 #include "ofMain.h"
 #include "ofxCv.h"
 
-class MotionAmplifier {
+class MotionAmplifier : public ofThread {
 private:
-    cv::Mat rescaled, flow3;
+    cv::Mat rescaled, blurred;
 	ofxCv::FlowFarneback flow;
-    ofShader shader;
+    ofShader shader, multiShader;
     float scaleFactor;
     ofTexture flowTexture;
     ofVboMesh mesh;
     float rescale;
     
+    // the dense grid is generated in MotionAmplifierGrid.vert: one instanced
+    // triangle strip per row, so the only vertex data is a single row of
+    // (x, 0), (x, 1) pairs. the full mesh is only built for sparse mode,
+    // which needs a per vertex attribute.
+    int width, height;
     int stepSize, xSteps, ySteps;
+    ofVbo gridRow;
+    int gridRowSteps;
     cv::Mat accumulator;
     bool needToReset;
     
-    void duplicateFirstChannel(cv::Mat& twoChannel, cv::Mat& threeChannel) {
-        vector<cv::Mat> each;
-        cv::split(twoChannel, each);
-        each.push_back(each[0]);
-        cv::merge(each, threeChannel);
+    // async mode: update() hands a rescaled frame to the worker, which runs
+    // the flow and post processing. the newest finished flow is uploaded on
+    // the next update() and frame ids track how far behind it is.
+    bool async;
+    bool needsUpdatingBack;
+    cv::Mat rescaledBack, rescaledFront, finishedFlow, uploadingFlow;
+    int submittedFrame, finishedFrame, uploadedFrame;
+    
+    // the setters only ask for a mode. the flow picks it up when it starts
+    // on the next frame, and each finished flow carries the mode it was made
+    // in, which the upload and the drawing then switch to. so neither side
+    // changes mode halfway through a frame.
+    struct Mode {
+        bool gpuAccumulation, sparse;
+        bool operator!=(const Mode& mode) const {
+            return gpuAccumulation != mode.gpuAccumulation || sparse != mode.sparse;
+        }
+    };
+    Mode nextMode, flowMode, finishedMode;
+    
+    // gpu accumulation: only the raw two channel flow is uploaded, and the
+    // blur and exponential accumulation run as ping-pong fbo passes
+    bool gpuAccumulation, needToResetGpu;
+    ofTexture rawFlowTexture;
+    ofShader blurShader, accumulateShader;
+    ofFbo blurFbo[2], accumulatorFbo[2];
+    int accumulatorIndex;
+    
+    // sparse mode: pyramidal lk only at the mesh vertices, seeded with the
+    // previous displacement. the accumulated displacement is one CV_32FC2
+    // element per vertex and is uploaded as a vertex attribute.
+    bool sparse;
+    ofShader sparseShader, sparseMultiShader;
+    cv::Mat sparseGray;
+    vector<cv::Mat> sparsePyramid, sparsePreviousPyramid;
+    vector<cv::Point2f> sparsePoints, sparseTracked;
+    vector<uchar> sparseStatus;
+    vector<float> sparseError;
+    cv::Mat sparseRaw, sparseAccumulator;
+    bool sparseUploaded;
+    
+    // scale, bias, exponential accumulation and edge zeroing in one sweep
+    // over the two channel flow, written straight into the upload buffer
+    void accumulateFlow(const cv::Mat& flow) {
+        int w = flow.cols, h = flow.rows;
+        float keep = 1 - learningRate;
+        float gain = learningRate * scaleFactor;
+        float bias = learningRate * .5;
+        if(needToReset || accumulator.size() != flow.size()) {
+            needToReset = false;
+            // zeros, because garbage times keep = 0 is still nan if it's nan
+            accumulator = cv::Mat::zeros(h, w, CV_32FC2);
+            keep = 0;
+            gain = scaleFactor;
+            bias = .5;
+        }
+        int n = 2 * w;
+        for(int y = 0; y < h; y++) {
+            const float* src = flow.ptr<float>(y);
+            float* dst = accumulator.ptr<float>(y);
+            if(y == 0 || y == h - 1) {
+                for(int i = 0; i < n; i++) {
+                    dst[i] = .5;
+                }
+                continue;
+            }
+            for(int i = 2; i < n - 2; i++) {
+                dst[i] = dst[i] * keep + src[i] * gain + bias;
+            }
+            dst[0] = dst[1] = dst[n - 2] = dst[n - 1] = .5;
+        }
     }
     
 public:
@@ -32,20 +105,106 @@ public:
     :strength(0)
     ,learningRate(.9)
     ,blurAmount(3)
-    ,windowSize(8) {
+    ,windowSize(8)
+    ,async(false)
+    ,needsUpdatingBack(false)
+    ,submittedFrame(0)
+    ,finishedFrame(0)
+    ,uploadedFrame(0)
+    ,gpuAccumulation(false)
+    ,needToResetGpu(false)
+    ,accumulatorIndex(0)
+    ,gridRowSteps(0)
+    ,sparse(false)
+    ,sparseUploaded(false) {
+        nextMode.gpuAccumulation = nextMode.sparse = false;
+        flowMode = finishedMode = nextMode;
     }
     
-    void setup(int w, int h, int stepSize, float rescale = 1) {
-        this->rescale = rescale;
-        shader.load("shaders/MotionAmplifier");
-        scaleFactor = 1. / 10; // could dynamically calculate this from flow3
-        needToReset = false;
-        
-        // should switch this to an ofPlanePrimitive
+    ~MotionAmplifier() {
+        setAsync(false);
+    }
+    
+    // run the optical flow on a worker thread instead of inside update()
+    void setAsync(bool async) {
+        if(async == this->async) {
+            return;
+        }
+        if(async) {
+            needsUpdatingBack = false;
+            submittedFrame = finishedFrame = uploadedFrame = 0;
+            this->async = true;
+            startThread();
+        } else {
+            waitForThread(true);
+            this->async = false;
+        }
+    }
+    
+    bool getAsync() {
+        return async;
+    }
+    
+    // upload only the raw flow and blur and accumulate it on the gpu
+    void setGpuAccumulation(bool gpuAccumulation) {
+        lock();
+        nextMode.gpuAccumulation = gpuAccumulation;
+        unlock();
+    }
+    
+    bool getGpuAccumulation() {
+        return nextMode.gpuAccumulation;
+    }
+    
+    // track only the mesh vertices instead of computing dense flow
+    void setSparse(bool sparse) {
+        lock();
+        nextMode.sparse = sparse;
+        unlock();
+    }
+    
+    bool getSparse() {
+        return nextMode.sparse;
+    }
+    
+    // called with the lock held, by whichever thread runs the flow
+    void applyMode() {
+        if(nextMode != flowMode) {
+            flowMode = nextMode;
+            needToReset = true;
+        }
+    }
+    
+    // how many submitted frames the uploaded flow is behind, 0 when synchronous
+    int getStaleness() {
+        return async ? submittedFrame - uploadedFrame : 0;
+    }
+    
+    void updateSteps() {
+        xSteps = 1+((rescale * width) / stepSize);
+        ySteps = 1+((rescale * height) / stepSize);
+    }
+    
+    void buildGridRow() {
+        vector<ofVec2f> row(2 * xSteps);
+        for(int x = 0; x < xSteps; x++) {
+            row[2 * x] = ofVec2f(x, 0);
+            row[2 * x + 1] = ofVec2f(x, 1);
+        }
+        gridRow.setVertexData(&row[0], row.size(), GL_STATIC_DRAW);
+        gridRowSteps = xSteps;
+    }
+    
+    void drawGrid() {
+        if(gridRowSteps != xSteps) {
+            buildGridRow();
+        }
+        gridRow.drawInstanced(GL_TRIANGLE_STRIP, 0, 2 * xSteps, ySteps - 1);
+    }
+    
+    void buildMesh() {
+        mesh.clear();
         mesh.setMode(OF_PRIMITIVE_TRIANGLES);
-        this->stepSize = stepSize;
-        xSteps = 1+((rescale * w) / stepSize);
-        ySteps = 1+((rescale * h) / stepSize);
         for(int y = 0; y < ySteps; y++) {
             for(int x = 0; x < xSteps; x++) {
                 mesh.addVertex(ofVec2f(x, y) * stepSize / rescale);
@@ -67,26 +226,286 @@ public:
         }
     }
     
-    template <class T>
-    void update(T& img) {
-        ofxCv::resize(img, rescaled, rescale, rescale);
+    void setup(int w, int h, int stepSize, float rescale = 1) {
+        this->rescale = rescale;
+        shader.load("shaders/MotionAmplifierGrid.vert", "shaders/MotionAmplifierWarp.frag");
+        multiShader.load("shaders/MotionAmplifierGrid.vert", "shaders/MotionAmplifierWarpMulti.frag");
+        blurShader.load("shaders/Flow.vert", "shaders/FlowBlur.frag");
+        accumulateShader.load("shaders/Flow.vert", "shaders/FlowAccumulate.frag");
+        loadSparseShader(sparseShader, "shaders/MotionAmplifierWarp.frag");
+        loadSparseShader(sparseMultiShader, "shaders/MotionAmplifierWarpMulti.frag");
+        scaleFactor = 1. / 10; // could dynamically calculate this from the flow
+        needToReset = false;
+        width = w;
+        height = h;
+        this->stepSize = stepSize;
+        updateSteps();
+    }
+    
+    // grid spacing in pixels of the rescaled flow. the dense grid costs
+    // nothing to change, sparse mode rebuilds its mesh and restarts tracking.
+    void setStepSize(int stepSize) {
+        stepSize = max(stepSize, 1);
+        if(stepSize != this->stepSize) {
+            lock();
+            this->stepSize = stepSize;
+            updateSteps();
+            needToReset = true;
+            unlock();
+        }
+    }
+    
+    int getStepSize() {
+        return stepSize;
+    }
+    
+    void calculateFlow(cv::Mat& rescaled) {
+        if(flowMode.sparse) {
+            calculateSparseFlow(rescaled);
+            return;
+        }
         flow.setWindowSize(windowSize);
 		flow.calcOpticalFlow(rescaled);
-        duplicateFirstChannel(flow.getFlow(), flow3);
-        flow3 *= scaleFactor;
-        flow3 += cv::Scalar_<float>(.5, .5, 0);
+        if(flowMode.gpuAccumulation) {
+            return;
+        }
+        // the box blur is linear, so it can run on the raw two channel flow
+        // before the scale and bias
         if(blurAmount > 0) {
-            ofxCv::blur(flow3, blurAmount);
+            ofxCv::blur(flow.getFlow(), blurred, blurAmount);
+            accumulateFlow(blurred);
+        } else {
+            accumulateFlow(flow.getFlow());
+        }
+    }
+    
+    // the flow that is ready to upload: raw for gpu accumulation, otherwise
+    // already blurred and accumulated
+    cv::Mat& getFlowResult() {
+        if(flowMode.sparse) {
+            return sparseAccumulator;
+        }
+        return flowMode.gpuAccumulation ? flow.getFlow() : accumulator;
+    }
+    
+    // main thread only, the gl work happens here
+    void uploadFlow(cv::Mat& flow, const Mode& mode) {
+        if(mode.sparse != sparse) {
+            sparse = mode.sparse;
+            sparseUploaded = false;
+        }
+        if(mode.gpuAccumulation != gpuAccumulation) {
+            gpuAccumulation = mode.gpuAccumulation;
+            needToResetGpu = true;
+        }
+        if(sparse) {
+            uploadSparseFlow(flow);
+            return;
+        }
+        int w = flow.cols, h = flow.rows;
+        ofTexture& target = gpuAccumulation ? rawFlowTexture : flowTexture;
+        if(!target.isAllocated() || target.getWidth() != w || target.getHeight() != h) {
+            target.allocate(w, h, GL_RG32F, GL_RG, GL_FLOAT);
+        }
+        target.loadData((float*) flow.ptr(), w, h, GL_RG);
+        if(gpuAccumulation) {
+            accumulateFlowGpu();
+        }
+    }
+    
+    void calculateSparseFlow(cv::Mat& rescaled) {
+        ofxCv::copyGray(rescaled, sparseGray);
+        cv::Size window(windowSize, windowSize);
+        int levels = 3;
+        cv::buildOpticalFlowPyramid(sparseGray, sparsePyramid, window, levels);
+        
+        // setStepSize() may be called from the main thread
+        lock();
+        int stepSize = this->stepSize, xSteps = this->xSteps, ySteps = this->ySteps;
+        unlock();
+        int n = xSteps * ySteps;
+        if(needToReset || sparseAccumulator.rows != ySteps || sparseAccumulator.cols != xSteps) {
+            needToReset = false;
+            sparsePoints.resize(n);
+            for(int y = 0; y < ySteps; y++) {
+                for(int x = 0; x < xSteps; x++) {
+                    sparsePoints[y * xSteps + x] = cv::Point2f(min(x * stepSize, sparseGray.cols - 1),
+                                                               min(y * stepSize, sparseGray.rows - 1));
+                }
+            }
+            sparseRaw = cv::Mat::zeros(ySteps, xSteps, CV_32FC2);
+            sparseAccumulator = cv::Mat::zeros(ySteps, xSteps, CV_32FC2);
+            sparsePreviousPyramid.clear();
+        }
+        if(sparsePreviousPyramid.empty()) {
+            swap(sparsePyramid, sparsePreviousPyramid);
+            return;
+        }
+        
+        const cv::Point2f* raw = sparseRaw.ptr<cv::Point2f>();
+        sparseTracked.resize(n);
+        for(int i = 0; i < n; i++) {
+            sparseTracked[i] = sparsePoints[i] + raw[i];
+        }
+        cv::calcOpticalFlowPyrLK(sparsePreviousPyramid, sparsePyramid, sparsePoints, sparseTracked,
+                                 sparseStatus, sparseError, window, levels,
+                                 cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 20, .03),
+                                 cv::OPTFLOW_USE_INITIAL_FLOW);
+        swap(sparsePyramid, sparsePreviousPyramid);
+        
+        // lost points and the border vertices don't move, like the edges of
+        // the dense flow
+        cv::Point2f* dst = sparseRaw.ptr<cv::Point2f>();
+        cv::Point2f* acc = sparseAccumulator.ptr<cv::Point2f>();
+        for(int y = 0; y < ySteps; y++) {
+            for(int x = 0; x < xSteps; x++) {
+                int i = y * xSteps + x;
+                bool edge = x == 0 || y == 0 || x + 1 == xSteps || y + 1 == ySteps;
+                dst[i] = (sparseStatus[i] && !edge) ? sparseTracked[i] - sparsePoints[i] : cv::Point2f();
+                acc[i] = acc[i] * (1 - learningRate) + dst[i] * learningRate;
+            }
+        }
+    }
+    
+    // both sparse programs read the displacement from the same vbo
+    // attribute, so it's bound to one location before they're linked instead
+    // of wherever each link puts it. 0 to 3 are ofShader's defaults.
+    static const int displacementLocation = 4;
+    
+    void loadSparseShader(ofShader& shader, string frag) {
+        shader.setupShaderFromFile(GL_VERTEX_SHADER, "shaders/MotionAmplifierSparse.vert");
+        shader.setupShaderFromFile(GL_FRAGMENT_SHADER, frag);
+        shader.bindDefaults();
+        shader.bindAttribute(displacementLocation, "displacement");
+        shader.linkProgram();
+    }
+    
+    void uploadSparseFlow(cv::Mat& flow) {
+        if(mesh.getNumVertices() != xSteps * ySteps) {
+            buildMesh();
+        }
+        if(flow.rows == ySteps && flow.cols == xSteps) {
+            mesh.getVbo().setAttributeData(displacementLocation, (float*) flow.ptr(), 2, flow.total(), GL_DYNAMIC_DRAW);
+            sparseUploaded = true;
+        }
+    }
+    
+    void accumulateFlowGpu() {
+        int w = rawFlowTexture.getWidth(), h = rawFlowTexture.getHeight();
+        bool reset = false;
+        if(needToResetGpu || accumulatorFbo[0].getWidth() != w || accumulatorFbo[0].getHeight() != h) {
+            needToResetGpu = false;
+            ofFbo::Settings settings;
+            settings.width = w;
+            settings.height = h;
+            settings.internalformat = GL_RG32F;
+            settings.useDepth = false;
+            settings.useStencil = false;
+            blurFbo[0].allocate(settings);
+            blurFbo[1].allocate(settings);
+            accumulatorFbo[0].allocate(settings);
+            accumulatorFbo[1].allocate(settings);
+            reset = true;
+        }
+        // same kernel size as ofxCv::blur, which forces it odd
+        int radius = blurAmount > 0 ? ((int) blurAmount) / 2 : 0;
+        
+        ofPushStyle();
+        ofDisableAlphaBlending();
+        
+        blurFbo[0].begin();
+        blurShader.begin();
+        blurShader.setUniformTexture("flow", rawFlowTexture, 1);
+        blurShader.setUniform2f("direction", 1, 0);
+        blurShader.setUniform1i("radius", radius);
+        blurShader.setUniform1f("scale", scaleFactor);
+        blurShader.setUniform1f("bias", .5);
+        rawFlowTexture.draw(0, 0);
+        blurShader.end();
+        blurFbo[0].end();
+        
+        blurFbo[1].begin();
+        blurShader.begin();
+        blurShader.setUniformTexture("flow", blurFbo[0].getTexture(), 1);
+        blurShader.setUniform2f("direction", 0, 1);
+        blurShader.setUniform1i("radius", radius);
+        blurShader.setUniform1f("scale", 1);
+        blurShader.setUniform1f("bias", 0);
+        blurFbo[0].draw(0, 0);
+        blurShader.end();
+        blurFbo[1].end();
+        
+        // the accumulators ping-pong: read the history from one, write into the other
+        ofFbo& previous = accumulatorFbo[accumulatorIndex];
+        ofFbo& next = accumulatorFbo[1 - accumulatorIndex];
+        next.begin();
+        accumulateShader.begin();
+        accumulateShader.setUniformTexture("current", blurFbo[1].getTexture(), 1);
+        accumulateShader.setUniformTexture("previous", previous.getTexture(), 2);
+        accumulateShader.setUniform1f("learningRate", learningRate);
+        // a new float fbo can hold nan, which mix() would pass through
+        accumulateShader.setUniform1i("reset", reset);
+        accumulateShader.setUniform2f("resolution", w, h);
+        blurFbo[1].draw(0, 0);
+        accumulateShader.end();
+        next.end();
+        
+        accumulatorIndex = 1 - accumulatorIndex;
+        
+        ofPopStyle();
+    }
+    
+    void threadedFunction() {
+        while(isThreadRunning()) {
+            lock();
+            bool needsUpdatingFront = needsUpdatingBack;
+            int frame = submittedFrame;
+            if(needsUpdatingFront) {
+                swap(rescaledBack, rescaledFront);
+                needsUpdatingBack = false;
+                applyMode();
+            }
+            unlock();
+            if(needsUpdatingFront) {
+                calculateFlow(rescaledFront);
+                lock();
+                getFlowResult().copyTo(finishedFlow);
+                finishedMode = flowMode;
+                finishedFrame = frame;
+                unlock();
+            } else {
+                ofSleepMillis(1);
+            }
+        }
+    }
+    
+    template <class T>
+    void update(T& img) {
+        ofxCv::resize(img, rescaled, rescale, rescale);
+        if(!async) {
+            lock();
+            applyMode();
+            unlock();
+            calculateFlow(rescaled);
+            uploadFlow(getFlowResult(), flowMode);
+            return;
+        }
+        lock();
+        swap(rescaled, rescaledBack);
+        needsUpdatingBack = true;
+        submittedFrame++;
+        bool finished = finishedFrame != uploadedFrame;
+        Mode mode = finishedMode;
+        if(finished) {
+            cv::swap(finishedFlow, uploadingFlow);
+            uploadedFrame = finishedFrame;
+        }
+        unlock();
+        // the worker only writes finishedFlow, so the upload doesn't need
+        // the lock
+        if(finished) {
+            uploadFlow(uploadingFlow, mode);
         }
-        int w = flow3.cols, h = flow3.rows;
-        if(needToReset || accumulator.size() != flow3.size()) {
-			needToReset = false;
-            ofxCv::copy(flow3, accumulator);
-		}
-		cv::accumulateWeighted(flow3, accumulator, learningRate);
-        // zero the edges
-        cv::rectangle(accumulator, cv::Point(0, 0), cv::Point(w-1, h-1), cv::Scalar(.5, .5, 0));
-        flowTexture.loadData((float*) accumulator.ptr(), w, h, GL_RGB);
     }
     
     void draw(ofBaseHasTexture& tex) {
@@ -94,34 +513,108 @@ public:
     }
     
     void draw(ofTexture& tex) {
+        if(sparse) {
+            drawSparse(&tex, OF_MESH_FILL);
+            return;
+        }
+        ofTexture& flowTexture = getFlowTexture();
         if(flowTexture.isAllocated()) {
             shader.begin();
             shader.setUniformTexture("source", tex, 1);
             shader.setUniformTexture("flow", flowTexture, 2);
-            shader.setUniform1f("strength", strength);
-            shader.setUniform1f("scaleFactor", scaleFactor);
-            shader.setUniform1f("flowRescale", rescale);
-            shader.setUniform1f("sourceRescale", 1);
-            mesh.drawFaces();
+            setWarpUniforms(shader, 1);
+            shader.setUniform1i("useSource", 1);
+            drawGrid();
             shader.end();
         }
     }
     
     void drawMesh() {
+        if(sparse) {
+            drawSparse(NULL, OF_MESH_WIREFRAME);
+            return;
+        }
+        ofTexture& flowTexture = getFlowTexture();
         if(flowTexture.isAllocated()) {
             shader.begin();
-            shader.setUniformTexture("source", flowTexture, 1);
             shader.setUniformTexture("flow", flowTexture, 2);
-            shader.setUniform1f("strength", strength);
-            shader.setUniform1f("scaleFactor", scaleFactor);
-            shader.setUniform1f("flowRescale", rescale);
-            shader.setUniform1f("sourceRescale", rescale);
-            mesh.drawWireframe();
+            setWarpUniforms(shader, rescale);
+            shader.setUniform1i("useSource", 0);
+            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+            drawGrid();
+            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
             shader.end();
         }
     }
     
+    // without a source the mesh is colored by its displacement, like drawMesh()
+    // colors it by the flow texture in dense mode
+    void drawSparse(ofTexture* tex, ofPolyRenderMode renderMode) {
+        if(!sparseUploaded || mesh.getNumVertices() != xSteps * ySteps) {
+            return;
+        }
+        sparseShader.begin();
+        if(tex != NULL) {
+            sparseShader.setUniformTexture("source", *tex, 1);
+        }
+        sparseShader.setUniform1i("useSource", tex != NULL);
+        setWarpUniforms(sparseShader, 1);
+        mesh.draw(renderMode);
+        sparseShader.end();
+    }
+    
+    void setWarpUniforms(ofShader& shader, float sourceRescale) {
+        shader.setUniform1f("strength", strength);
+        shader.setUniform1f("scaleFactor", scaleFactor);
+        shader.setUniform1f("flowRescale", rescale);
+        shader.setUniform1f("sourceRescale", sourceRescale);
+        shader.setUniform1f("gridStep", stepSize / rescale);
+    }
+    
+    // MotionAmplifierWarpMulti.frag has this many source samplers
+    static const int maxSources = 4;
+    
+    // warp several sources with one draw of the grid, source i is written to
+    // gl_FragData[i]. the caller binds an fbo with that many color buffers,
+    // all of them active, e.g. with ofFbo::activateAllDrawBuffers().
+    void draw(const vector<ofTexture*>& sources) {
+        int n = min((int) sources.size(), (int) maxSources);
+        if(n == 0) {
+            return;
+        }
+        if(sparse) {
+            if(!sparseUploaded || mesh.getNumVertices() != xSteps * ySteps) {
+                return;
+            }
+            sparseMultiShader.begin();
+            setSources(sparseMultiShader, sources, n);
+            setWarpUniforms(sparseMultiShader, 1);
+            mesh.draw(OF_MESH_FILL);
+            sparseMultiShader.end();
+            return;
+        }
+        ofTexture& flowTexture = getFlowTexture();
+        if(flowTexture.isAllocated()) {
+            multiShader.begin();
+            setSources(multiShader, sources, n);
+            multiShader.setUniformTexture("flow", flowTexture, 1 + maxSources);
+            setWarpUniforms(multiShader, 1);
+            drawGrid();
+            multiShader.end();
+        }
+    }
+    
+    void setSources(ofShader& shader, const vector<ofTexture*>& sources, int n) {
+        for(int i = 0; i < n; i++) {
+            shader.setUniformTexture("source" + ofToString(i), *sources[i], 1 + i);
+        }
+        shader.setUniform1i("sourceCount", n);
+    }
+    
     ofTexture& getFlowTexture() {
+        if(gpuAccumulation && accumulatorFbo[accumulatorIndex].isAllocated()) {
+            return accumulatorFbo[accumulatorIndex].getTexture();
+        }
         return flowTexture;
     }
     
@@ -0,0 +1,293 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxCv.h"
+#include "ofxFaceTrackerThreaded.h"
+
+// tracks several faces at once. every few frames a haar pass looks for
+// faces that aren't being tracked yet, and each one gets a threaded tracker
+// from a pool that only sees a crop around its face. the haar pass and the
+// fits run on their own threads, the main thread only crops and merges the
+// meshes.
+class MultiFaceTracker {
+protected:
+    // runs the haar pass on a downscaled copy of the frame. the results come
+    // back a few frames late, which the padding around each crop absorbs.
+    class Detector : public ofThread {
+    public:
+        ofxCv::ObjectFinder finder;
+        cv::Mat image;
+        vector<ofRectangle> objects;
+        bool hasImage, hasObjects;
+        
+        Detector()
+        :hasImage(false)
+        ,hasObjects(false) {
+        }
+        
+        void threadedFunction() {
+            cv::Mat gray;
+            while(isThreadRunning()) {
+                lock();
+                bool ready = hasImage;
+                if(ready) {
+                    cv::swap(image, gray);
+                    hasImage = false;
+                }
+                unlock();
+                if(ready) {
+                    finder.update(gray);
+                    vector<ofRectangle> found;
+                    for(int i = 0; i < finder.size(); i++) {
+                        found.push_back(finder.getObject(i));
+                    }
+                    lock();
+                    objects.swap(found);
+                    hasObjects = true;
+                    unlock();
+                } else {
+                    ofSleepMillis(5);
+                }
+            }
+        }
+    };
+    
+    struct Face {
+        shared_ptr<ofxFaceTrackerThreaded> tracker;
+        ofRectangle crop;
+        // the last fit seen in crop coordinates, and the last one used in
+        // image coordinates
+        vector<ofVec2f> lastFit;
+        ofMesh mesh;
+        int lost;
+        bool active;
+        // after a crop change the tracker can still return the fit it had,
+        // or finish one it started in the old crop. neither can be offset
+        // by the new crop, so the fits that are the same as lastFit are
+        // ignored, and so is the first new one when a fit was running.
+        bool staleFit, pendingFit;
+    };
+    
+    Detector detector;
+    vector<Face> faces;
+    int maxFaces, detectionInterval, maxLost, frame;
+    float padding, detectionRescale;
+    bool detecting;
+    ofRectangle bounds;
+    ofMesh imageMesh;
+    int found;
+    
+    // the detection grown by padding on every side, inside the image
+    ofRectangle getCrop(const ofRectangle& rect) {
+        ofRectangle crop = rect;
+        crop.x -= rect.width * padding;
+        crop.y -= rect.height * padding;
+        crop.width += 2 * rect.width * padding;
+        crop.height += 2 * rect.height * padding;
+        crop = crop.getIntersection(bounds);
+        crop.set((int) crop.x, (int) crop.y, (int) crop.width, (int) crop.height);
+        return crop;
+    }
+    
+    bool isTracked(const ofRectangle& rect) {
+        for(int i = 0; i < faces.size(); i++) {
+            if(faces[i].active && faces[i].crop.inside(rect.getCenter())) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void setCrop(Face& face, const ofRectangle& crop) {
+        face.lastFit = face.tracker->getImagePoints();
+        face.staleFit = true;
+        face.pendingFit = face.active;
+        face.crop = crop;
+        face.tracker->reset();
+    }
+    
+    Face* getFreeFace() {
+        for(int i = 0; i < faces.size(); i++) {
+            if(!faces[i].active) {
+                return &faces[i];
+            }
+        }
+        if(faces.size() < maxFaces) {
+            faces.push_back(Face());
+            Face& face = faces.back();
+            face.tracker = shared_ptr<ofxFaceTrackerThreaded>(new ofxFaceTrackerThreaded());
+            face.tracker->setup();
+            face.active = false;
+            return &face;
+        }
+        return NULL;
+    }
+    
+    // hands the frame to the detector unless it's still busy with the last
+    // one. the copy is gray, the detector only looks at gray anyway.
+    void detect(cv::Mat& image) {
+        detector.lock();
+        if(!detecting) {
+            ofxCv::copyGray(image, detector.image);
+            detector.hasImage = true;
+            detecting = true;
+        }
+        detector.unlock();
+    }
+    
+    // starts tracking the faces from the last detection that finished
+    void addDetected() {
+        vector<ofRectangle> objects;
+        detector.lock();
+        bool ready = detector.hasObjects;
+        if(ready) {
+            objects.swap(detector.objects);
+            detector.hasObjects = false;
+            detecting = false;
+        }
+        detector.unlock();
+        for(int i = 0; i < objects.size(); i++) {
+            ofRectangle& rect = objects[i];
+            if(isTracked(rect)) {
+                continue;
+            }
+            Face* face = getFreeFace();
+            if(face == NULL) {
+                break;
+            }
+            setCrop(*face, getCrop(rect));
+            face->mesh.clear();
+            face->lost = 0;
+            face->active = true;
+        }
+    }
+
+public:
+    MultiFaceTracker()
+    :maxFaces(4)
+    ,detectionInterval(10)
+    ,maxLost(30)
+    ,frame(0)
+    ,padding(.5)
+    ,detectionRescale(.25)
+    ,detecting(false)
+    ,found(0) {
+    }
+    
+    ~MultiFaceTracker() {
+        stopThreads();
+    }
+    
+    void stopThreads() {
+        detector.waitForThread(true);
+        for(int i = 0; i < faces.size(); i++) {
+            faces[i].tracker->waitForThread(true);
+        }
+    }
+    
+    void setup(int maxFaces = 4) {
+        this->maxFaces = maxFaces;
+        detector.finder.setup("model/haarcascade_frontalface_alt2.xml");
+        detector.finder.setPreset(ofxCv::ObjectFinder::Fast);
+        detector.finder.setRescale(detectionRescale);
+        detector.startThread();
+    }
+    
+    void setDetectionInterval(int detectionInterval) {
+        this->detectionInterval = MAX(detectionInterval, 1);
+    }
+    
+    // the scale of the frame the haar pass sees, call it before setup()
+    void setDetectionRescale(float detectionRescale) {
+        this->detectionRescale = detectionRescale;
+    }
+    
+    void update(cv::Mat image) {
+        bounds.set(0, 0, image.cols, image.rows);
+        if(frame++ % detectionInterval == 0) {
+            detect(image);
+        }
+        addDetected();
+        
+        found = 0;
+        imageMesh.clear();
+        for(int i = 0; i < faces.size(); i++) {
+            Face& face = faces[i];
+            if(!face.active) {
+                continue;
+            }
+            face.tracker->update(image(ofxCv::toCv(face.crop)));
+            if(!face.tracker->getFound()) {
+                if(++face.lost > maxLost) {
+                    face.active = false;
+                }
+                continue;
+            }
+            face.lost = 0;
+            
+            vector<ofVec2f> points = face.tracker->getImagePoints();
+            if(face.staleFit) {
+                if(points != face.lastFit) {
+                    face.lastFit = points;
+                    face.staleFit = face.pendingFit;
+                    face.pendingFit = false;
+                }
+                // the last mesh stands in until there's a fit in this crop
+                if(face.staleFit) {
+                    if(face.mesh.getNumVertices() > 0) {
+                        imageMesh.append(face.mesh);
+                        found++;
+                    }
+                    continue;
+                }
+            }
+            face.lastFit = points;
+            
+            face.mesh = face.tracker->getImageMesh();
+            vector<ofVec3f>& vertices = face.mesh.getVertices();
+            for(int j = 0; j < vertices.size(); j++) {
+                vertices[j] += face.crop.getPosition();
+            }
+            ofRectangle fit(vertices[0], 0, 0);
+            for(int j = 1; j < vertices.size(); j++) {
+                fit.growToInclude(vertices[j]);
+            }
+            imageMesh.append(face.mesh);
+            found++;
+            
+            // recenter when the face gets close to the edge of its crop. the
+            // tracker starts over, because its last fit is in the old crop.
+            ofRectangle inner = face.crop;
+            inner.scaleFromCenter(1. / (1 + padding));
+            if(!inner.inside(fit)) {
+                setCrop(face, getCrop(fit));
+            }
+        }
+    }
+    
+    bool getFound() const {
+        return found > 0;
+    }
+    
+    // how many faces were fitted in the last update
+    int size() const {
+        return found;
+    }
+    
+    // all the fitted faces, one after another, in image coordinates
+    ofMesh& getImageMesh() {
+        return imageMesh;
+    }
+    
+    void draw() {
+        ofPushStyle();
+        ofNoFill();
+        for(int i = 0; i < faces.size(); i++) {
+            if(faces[i].active) {
+                ofDrawRectangle(faces[i].crop);
+            }
+        }
+        ofPopStyle();
+        imageMesh.drawWireframe();
+    }
+};
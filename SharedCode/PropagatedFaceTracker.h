@@ -0,0 +1,353 @@
+#pragma once
+
+#include "ofMain.h"
+#include "ofxCv.h"
+#include "ofxFaceTrackerThreaded.h"
+
+// only hands every fitInterval-th frame to the threaded tracker for a full
+// fit, and moves the landmarks along with sparse optical flow in between.
+// a full fit also happens as soon as too many landmarks lose the flow. when
+// a fit comes back it was made on an older frame, so it's flowed from that
+// frame to the current one before it's used.
+//
+// with setRoi(true) the fits only see a padded window around the face,
+// tracked at a higher resolution than the whole frame would allow. after a
+// loss the window grows outward from where the face was, and the whole frame
+// is only searched once the window covers it.
+//
+// getPosition() follows the landmarks between fits. the rest of the pose,
+// getScale(), getOrientation() and getRotationMatrix(), and getHaarFound()
+// come straight from the last full fit, so they lag behind by up to
+// fitInterval frames.
+class PropagatedFaceTracker : public ofxFaceTrackerThreaded {
+protected:
+    cv::Mat gray, prevGray, fitGray;
+    vector<cv::Point2f> points, lastFit;
+    int fitInterval, sinceFit;
+    float minConfidence, maxError, confidence;
+    bool found, fitPending, propagated, staleFit;
+    
+    bool roi;
+    float padding, rescale;
+    int searchStep, sinceReset, maxResetWait;
+    ofRectangle bounds, face, fitCrop;
+    ofVec2f fitPosition, fitCenter;
+    
+    // the last fit in the coordinates of the crop it was made in
+    vector<cv::Point2f> getFitPoints() const {
+        int n = ofxFaceTrackerThreaded::size();
+        vector<cv::Point2f> fit(n);
+        for(int i = 0; i < n; i++) {
+            fit[i] = ofxCv::toCv(ofxFaceTrackerThreaded::getImagePoint(i));
+        }
+        return fit;
+    }
+    
+    ofRectangle getBoundingBox(const vector<cv::Point2f>& points) const {
+        ofRectangle box(points[0].x, points[0].y, 0, 0);
+        for(int i = 1; i < points.size(); i++) {
+            box.growToInclude(points[i].x, points[i].y);
+        }
+        return box;
+    }
+    
+    // the window the next fit should see. while the face is found the window
+    // stays put until the face gets close to its edge, because moving it
+    // means the tracker has to start over. when the face is lost the window
+    // doubles its padding with every failed search.
+    ofRectangle getSearchCrop() const {
+        if(!roi || face.isEmpty()) {
+            return bounds;
+        }
+        if(found) {
+            ofRectangle inner = fitCrop;
+            inner.scaleFromCenter(1. / (1 + 2 * padding));
+            if(fitCrop != bounds && inner.inside(face)) {
+                return fitCrop;
+            }
+        }
+        float grow = padding * (1 << MIN(searchStep, 8));
+        ofRectangle crop = face;
+        crop.x -= face.width * grow;
+        crop.y -= face.height * grow;
+        crop.width += 2 * face.width * grow;
+        crop.height += 2 * face.height * grow;
+        crop = crop.getIntersection(bounds);
+        crop.set((int) crop.x, (int) crop.y, (int) crop.width, (int) crop.height);
+        // not worth a window that's nearly the whole frame
+        if(crop.getArea() > bounds.getArea() / 2) {
+            return bounds;
+        }
+        return crop;
+    }
+    
+    // a window gets as many pixels as the whole frame would at rescale, up
+    // to full resolution
+    float getCropRescale(const ofRectangle& crop) const {
+        return MIN(1, rescale * sqrt(bounds.getArea() / crop.getArea()));
+    }
+    
+    void submitFit(cv::Mat& image) {
+        ofRectangle crop = getSearchCrop();
+        if(crop != fitCrop) {
+            // the fit that's there now, and one that's still running, were
+            // made in the old crop and can't be offset by the new one
+            lastFit = getFitPoints();
+            staleFit = fitPending;
+            ofxFaceTrackerThreaded::reset();
+            ofxFaceTrackerThreaded::setRescale(getCropRescale(crop));
+            fitCrop = crop;
+            sinceReset = 0;
+        }
+        ofxFaceTrackerThreaded::update(image(ofxCv::toCv(fitCrop)));
+    }
+    
+    ofVec2f getCenter(const vector<cv::Point2f>& points) const {
+        ofVec2f center;
+        for(int i = 0; i < points.size(); i++) {
+            center += ofxCv::toOf(points[i]);
+        }
+        return points.empty() ? center : center / points.size();
+    }
+    
+    bool isNewFit(const vector<cv::Point2f>& fit) const {
+        if(fit.size() != lastFit.size()) {
+            return true;
+        }
+        for(int i = 0; i < fit.size(); i++) {
+            if(fit[i] != lastFit[i]) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // moves from along the flow between prev and next. returns the fraction
+    // of points that were followed, the others move with the median of the
+    // ones that were.
+    float flow(const cv::Mat& prev, const cv::Mat& next, const vector<cv::Point2f>& from, vector<cv::Point2f>& to) {
+        if(from.empty()) {
+            to.clear();
+            return 0;
+        }
+        vector<unsigned char> status;
+        vector<float> error;
+        to = from;
+        cv::calcOpticalFlowPyrLK(prev, next, from, to, status, error,
+                                 cv::Size(21, 21), 3,
+                                 cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 20, .03),
+                                 cv::OPTFLOW_USE_INITIAL_FLOW);
+        vector<float> dx, dy;
+        for(int i = 0; i < from.size(); i++) {
+            if(status[i] && error[i] < maxError) {
+                dx.push_back(to[i].x - from[i].x);
+                dy.push_back(to[i].y - from[i].y);
+            }
+        }
+        if(dx.empty()) {
+            return 0;
+        }
+        nth_element(dx.begin(), dx.begin() + dx.size() / 2, dx.end());
+        nth_element(dy.begin(), dy.begin() + dy.size() / 2, dy.end());
+        cv::Point2f median(dx[dx.size() / 2], dy[dy.size() / 2]);
+        for(int i = 0; i < from.size(); i++) {
+            if(!status[i] || error[i] >= maxError) {
+                to[i] = from[i] + median;
+            }
+        }
+        return (float) dx.size() / from.size();
+    }
+    
+public:
+    PropagatedFaceTracker()
+    :fitInterval(1)
+    ,sinceFit(0)
+    ,minConfidence(.8)
+    ,maxError(20)
+    ,confidence(0)
+    ,found(false)
+    ,fitPending(false)
+    ,propagated(false)
+    ,staleFit(false)
+    ,roi(false)
+    ,padding(.5)
+    ,rescale(1)
+    ,searchStep(0)
+    ,sinceReset(-1)
+    ,maxResetWait(5) {
+    }
+    
+    // 1 fits as often as the tracker thread keeps up, the frames in between
+    // are flowed
+    void setFitInterval(int fitInterval) {
+        this->fitInterval = MAX(fitInterval, 1);
+    }
+    
+    // the fraction of landmarks that have to follow the flow, below this
+    // the next frame gets a full fit
+    void setMinConfidence(float minConfidence) {
+        this->minConfidence = minConfidence;
+    }
+    
+    void setRoi(bool roi) {
+        this->roi = roi;
+    }
+    
+    // the rescale used for whole frame fits
+    void setRescale(float rescale) {
+        if(rescale != this->rescale) {
+            this->rescale = rescale;
+            ofxFaceTrackerThreaded::setRescale(fitCrop.isEmpty() ? rescale : getCropRescale(fitCrop));
+        }
+    }
+    
+    bool update(cv::Mat image) {
+        ofxCv::copyGray(image, gray);
+        bounds.set(0, 0, image.cols, image.rows);
+        if(fitCrop.isEmpty()) {
+            fitCrop = bounds;
+        }
+        
+        // pick up a fit that finished since the last frame
+        bool fitted = false;
+        if(fitPending) {
+            vector<cv::Point2f> fit = getFitPoints();
+            bool fitFound = ofxFaceTrackerThreaded::getFound();
+            // after a reset there's nothing to report until the new window
+            // has been searched, which can take a few frames
+            if(!fitFound && sinceReset >= 0 && sinceReset < maxResetWait) {
+                sinceReset++;
+            } else if(!fitFound) {
+                if(!found) {
+                    searchStep++;
+                }
+                found = false;
+                points.clear();
+                fitPending = false;
+                sinceReset = -1;
+            } else if(isNewFit(fit) && staleFit) {
+                lastFit = fit;
+                staleFit = false;
+            } else if(isNewFit(fit)) {
+                lastFit = fit;
+                cv::Point2f offset(fitCrop.x, fitCrop.y);
+                for(int i = 0; i < fit.size(); i++) {
+                    fit[i] += offset;
+                }
+                fitPosition = ofxFaceTrackerThreaded::getPosition() + ofVec2f(fitCrop.x, fitCrop.y);
+                fitCenter = getCenter(fit);
+                confidence = flow(fitGray, gray, fit, points);
+                found = true;
+                fitPending = false;
+                fitted = true;
+                sinceReset = -1;
+            }
+        }
+        
+        propagated = false;
+        if(found && !fitted && !prevGray.empty()) {
+            vector<cv::Point2f> next;
+            confidence = flow(prevGray, gray, points, next);
+            points = next;
+            propagated = true;
+        }
+        
+        sinceFit++;
+        bool needsFit = !found || sinceFit >= fitInterval || confidence < minConfidence;
+        // a fit that hasn't come back yet would be flowed from the wrong
+        // frame if another one replaced it, so wait for it unless it's late,
+        // also when every frame is fitted
+        bool waiting = fitPending && sinceFit < MAX(2 * fitInterval, maxResetWait);
+        if(needsFit && !waiting) {
+            if(found) {
+                face = getBoundingBox(points);
+                searchStep = 0;
+            }
+            // a late fit can still come back after this one replaced it, so
+            // the next new result is dropped, like after a crop change
+            if(fitPending) {
+                lastFit = getFitPoints();
+                staleFit = true;
+            }
+            submitFit(image);
+            gray.copyTo(fitGray);
+            fitPending = true;
+            sinceFit = 0;
+        }
+        
+        cv::swap(gray, prevGray);
+        return found;
+    }
+    
+    void reset() {
+        ofxFaceTrackerThreaded::reset();
+        points.clear();
+        lastFit.clear();
+        face.set(0, 0, 0, 0);
+        fitCrop = bounds;
+        ofxFaceTrackerThreaded::setRescale(rescale);
+        searchStep = 0;
+        sinceReset = -1;
+        found = false;
+        fitPending = false;
+        propagated = false;
+        staleFit = false;
+        confidence = 0;
+        sinceFit = 0;
+    }
+    
+    bool getFound() const {
+        return found;
+    }
+    
+    // whether the last update moved the landmarks with the flow
+    bool getPropagated() const {
+        return propagated;
+    }
+    
+    // the fraction of landmarks that followed the flow in the last update
+    float getConfidence() const {
+        return confidence;
+    }
+    
+    // the position of the last fit, moved as far as the landmarks have
+    // moved since
+    ofVec2f getPosition() const {
+        if(points.empty()) {
+            return fitPosition;
+        }
+        return fitPosition + getCenter(points) - fitCenter;
+    }
+    
+    int size() const {
+        return points.size();
+    }
+    
+    ofVec2f getImagePoint(int i) const {
+        return ofxCv::toOf(points[i]);
+    }
+    
+    vector<ofVec2f> getImagePoints() const {
+        vector<ofVec2f> imagePoints(points.size());
+        for(int i = 0; i < points.size(); i++) {
+            imagePoints[i] = ofxCv::toOf(points[i]);
+        }
+        return imagePoints;
+    }
+    
+    ofMesh getImageMesh() const {
+        return getMesh(getImagePoints());
+    }
+    
+    void draw(bool drawLabels = false) const {
+        if(roi) {
+            ofPushStyle();
+            ofNoFill();
+            ofDrawRectangle(fitCrop);
+            ofPopStyle();
+        }
+        if(found) {
+            getImageMesh().drawWireframe();
+        }
+    }
+};
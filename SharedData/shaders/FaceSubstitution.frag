@@ -0,0 +1,18 @@
+#version 120
+
+// the mask goes to color buffer 0 and source i to color buffer 1 + i
+
+uniform sampler2DRect src0;
+uniform sampler2DRect src1;
+uniform sampler2DRect src2;
+uniform int count;
+varying vec2 coord0;
+varying vec2 coord1;
+varying vec2 coord2;
+
+void main() {
+    gl_FragData[0] = vec4(1.);
+    gl_FragData[1] = texture2DRect(src0, coord0);
+    if(count > 1) gl_FragData[2] = texture2DRect(src1, coord1);
+    if(count > 2) gl_FragData[3] = texture2DRect(src2, coord2);
+}
@@ -0,0 +1,16 @@
+#version 120
+
+// source 0 uses the regular texcoords, the others come in as attributes
+
+attribute vec2 srcCoord1;
+attribute vec2 srcCoord2;
+varying vec2 coord0;
+varying vec2 coord1;
+varying vec2 coord2;
+
+void main() {
+    coord0 = gl_MultiTexCoord0.xy;
+    coord1 = srcCoord1;
+    coord2 = srcCoord2;
+    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+}
@@ -0,0 +1,25 @@
+#version 120
+
+// exponential accumulation of the packed flow, with the border held at .5
+// (no motion) to match the cpu path
+
+uniform sampler2DRect current;
+uniform sampler2DRect previous;
+uniform float learningRate;
+uniform int reset;
+uniform vec2 resolution;
+varying vec2 texCoord;
+
+void main() {
+    if(texCoord.x < 1. || texCoord.y < 1. || texCoord.x > resolution.x - 1. || texCoord.y > resolution.y - 1.) {
+        gl_FragColor = vec4(.5, .5, 0., 1.);
+        return;
+    }
+    vec2 cur = texture2DRect(current, texCoord).xy;
+    if(reset == 1) {
+        gl_FragColor = vec4(cur, 0., 1.);
+        return;
+    }
+    vec2 prev = texture2DRect(previous, texCoord).xy;
+    gl_FragColor = vec4(mix(prev, cur, learningRate), 0., 1.);
+}
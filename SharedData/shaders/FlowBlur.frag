@@ -0,0 +1,25 @@
+#version 120
+
+// one separable pass of a box blur over the two channel flow, followed by
+// scale and bias so the horizontal pass can also pack the flow around .5
+
+uniform sampler2DRect flow;
+uniform vec2 direction;
+uniform int radius;
+uniform float scale;
+uniform float bias;
+varying vec2 texCoord;
+
+const int maxRadius = 16;
+
+void main() {
+    vec2 sum = vec2(0.);
+    float count = 0.;
+    for(int i = -maxRadius; i <= maxRadius; i++) {
+        if(i >= -radius && i <= radius) {
+            sum += texture2DRect(flow, texCoord + direction * float(i)).xy;
+            count++;
+        }
+    }
+    gl_FragColor = vec4(sum / count * scale + bias, 0., 1.);
+}
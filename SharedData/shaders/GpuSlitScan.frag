@@ -0,0 +1,49 @@
+#version 120
+#extension GL_EXT_texture_array : require
+
+// frames is a ring of capacity layers with the newest frame at layer
+// newest. delays are in frames, 0 is the newest. with yuv, frames only has
+// luma and chroma has the half resolution u and v.
+
+uniform sampler2DArray frames;
+uniform sampler2DArray chroma;
+uniform int yuv;
+uniform sampler2DRect delayMap;
+uniform int useDelayMap;
+uniform vec2 size;
+uniform float newest;
+uniform float count;
+uniform float capacity;
+uniform float timeDelay;
+uniform float timeWidth;
+uniform int blending;
+varying vec2 texCoord;
+
+vec4 getFrame(float delay) {
+    delay = clamp(delay, 0., count - 1.);
+    float layer = mod(newest - delay + capacity, capacity);
+    vec3 position = vec3(texCoord / size, layer);
+    if(yuv == 0) {
+        return texture2DArray(frames, position);
+    }
+    float y = texture2DArray(frames, position).r;
+    vec2 uv = texture2DArray(chroma, position).rg - .5;
+    return vec4(
+        y + 1.402 * uv.y,
+        y - .344136 * uv.x - .714136 * uv.y,
+        y + 1.772 * uv.x,
+        1.);
+}
+
+void main() {
+    float delay = timeDelay;
+    if(useDelayMap != 0) {
+        delay += texture2DRect(delayMap, texCoord).r * timeWidth;
+    }
+    float before = floor(delay);
+    if(blending != 0) {
+        gl_FragColor = mix(getFrame(before), getFrame(before + 1.), delay - before);
+    } else {
+        gl_FragColor = getFrame(before);
+    }
+}
@@ -0,0 +1,18 @@
+#version 120
+
+// full range bt.601, luma into r or u and v into rg. the chroma pass draws
+// at half size, so linear filtering averages each 2x2 block.
+
+uniform sampler2DRect tex;
+uniform int chroma;
+varying vec2 texCoord;
+
+void main() {
+    vec3 rgb = texture2DRect(tex, texCoord).rgb;
+    float y = dot(rgb, vec3(.299, .587, .114));
+    if(chroma == 0) {
+        gl_FragColor = vec4(y, 0., 0., 1.);
+    } else {
+        gl_FragColor = vec4((rgb.b - y) * .564 + .5, (rgb.r - y) * .713 + .5, 0., 1.);
+    }
+}
@@ -0,0 +1,23 @@
+#version 120
+#extension GL_ARB_draw_instanced : require
+
+// one instance per row of the grid. the vertex only holds (x, 0) or (x, 1)
+// in grid steps, the row comes from the instance id.
+
+uniform sampler2DRect flow;
+uniform float strength;
+uniform float scaleFactor;
+uniform float flowRescale;
+uniform float sourceRescale;
+uniform float gridStep;
+varying vec2 texCoord;
+varying vec2 flowColor;
+
+void main() {
+    vec2 position = (gl_Vertex.xy + vec2(0., float(gl_InstanceIDARB))) * gridStep;
+    vec2 packedFlow = texture2DRect(flow, position * flowRescale).xy;
+    vec2 offset = (packedFlow - .5) / scaleFactor / flowRescale;
+    texCoord = position * sourceRescale;
+    flowColor = packedFlow;
+    gl_Position = gl_ModelViewProjectionMatrix * vec4(position + offset * strength, 0., 1.);
+}
@@ -0,0 +1,20 @@
+#version 120
+
+// the displacement comes per vertex from the sparse tracker, in pixels of
+// the rescaled flow image
+
+attribute vec2 displacement;
+uniform float strength;
+uniform float scaleFactor;
+uniform float flowRescale;
+uniform float sourceRescale;
+varying vec2 texCoord;
+varying vec2 flowColor;
+
+void main() {
+    texCoord = gl_Vertex.xy * sourceRescale;
+    flowColor = displacement * scaleFactor + .5;
+    vec4 position = gl_Vertex;
+    position.xy += displacement / flowRescale * strength;
+    gl_Position = gl_ModelViewProjectionMatrix * position;
+}
@@ -0,0 +1,14 @@
+#version 120
+
+uniform sampler2DRect source;
+uniform int useSource;
+varying vec2 texCoord;
+varying vec2 flowColor;
+
+void main() {
+    if(useSource != 0) {
+        gl_FragColor = texture2DRect(source, texCoord);
+    } else {
+        gl_FragColor = vec4(flowColor, 0., 1.);
+    }
+}
@@ -0,0 +1,18 @@
+#version 120
+
+// writes source i to color buffer i. samplers can't be indexed dynamically
+// in glsl 120, so the sources are unrolled.
+
+uniform sampler2DRect source0;
+uniform sampler2DRect source1;
+uniform sampler2DRect source2;
+uniform sampler2DRect source3;
+uniform int sourceCount;
+varying vec2 texCoord;
+
+void main() {
+    gl_FragData[0] = texture2DRect(source0, texCoord);
+    if(sourceCount > 1) gl_FragData[1] = texture2DRect(source1, texCoord);
+    if(sourceCount > 2) gl_FragData[2] = texture2DRect(source2, texCoord);
+    if(sourceCount > 3) gl_FragData[3] = texture2DRect(source3, texCoord);
+}